@@ -7,8 +7,15 @@
 
 /* pieces section */
 
+/* statx() is a GNU extension */
+#define _GNU_SOURCE
+
 #include <errno.h>
 /* errno
+ * EINTR
+ * ENXIO
+ * EWOULDBLOCK
+ * ETIMEDOUT
  */
 
 #include <stdio.h>
@@ -21,7 +28,13 @@
  * printf()
  * fprintf()
  * sprintf()
+ * snprintf()
  * perror()
+ * FILE
+ * fopen()
+ * fclose()
+ * tmpfile()
+ * fileno()
  */
 
 #include <stdlib.h>
@@ -31,19 +44,32 @@
  * EXIT_SUCCESS
  * exit()
  * malloc()
+ * calloc()
+ * aligned_alloc()
  * realloc()
  * free()
+ * strtoul()
+ * strtoull()
+ * qsort()
  */
 
 #include <string.h>
 /* strlen()
  * strcpy()
  * strcmp()
+ * memcpy()
+ * memmove()
+ * memcmp()
+ * memchr()
+ * memset()
  * strerror_l()
  */
 
 #include <stdint.h>
 /* uintmax_t
+ * uintptr_t
+ * uint32_t
+ * uint64_t
  */
 
 #include <stdbool.h>
@@ -55,9 +81,29 @@
 #include <dirent.h>
 /* DIR
  * struct dirent
- * opendir()
+ * fdopendir()
  * readdir()
  * closedir()
+ * dirfd()
+ * telldir()
+ * seekdir()
+ * DT_UNKNOWN
+ */
+
+#include <fcntl.h>
+/* open()
+ * openat()
+ * O_RDONLY
+ * O_DIRECTORY
+ * O_CLOEXEC
+ * O_NOCTTY
+ * O_NONBLOCK
+ * AT_FDCWD
+ * AT_SYMLINK_NOFOLLOW
+ * AT_STATX_DONT_SYNC
+ * posix_fadvise()
+ * POSIX_FADV_SEQUENTIAL
+ * POSIX_FADV_NOREUSE
  */
 
 #include <locale.h>
@@ -66,18 +112,262 @@
 
 #include <unistd.h>
 /* getopt()
+ * close()
+ * read()
+ * pread()
+ * pwrite()
+ * lseek()
+ * SEEK_DATA
+ * SEEK_HOLE
+ * ftruncate()
+ * write()
+ * ssize_t
+ * STDIN_FILENO
+ * STDOUT_FILENO
  */
 
 #include <sys/stat.h>
 /* struct stat
  * stat()
+ * fstat()
+ * fstatat()
+ * struct statx
+ * statx()
+ * STATX_TYPE
+ * STATX_MODE
+ * STATX_INO
+ * STATX_SIZE
+ * STATX_MTIME
+ * STATX_NLINK
  * S_ISREG()
  * S_ISDIR()
  */
 
+#include <sys/mman.h>
+/* mmap()
+ * munmap()
+ * posix_madvise()
+ * MAP_FAILED
+ * MAP_SHARED
+ * MAP_PRIVATE
+ * MAP_POPULATE
+ * PROT_READ
+ * PROT_WRITE
+ * POSIX_MADV_SEQUENTIAL
+ */
+
+#include <sys/file.h>
+/* flock()
+ * LOCK_SH
+ * LOCK_EX
+ * LOCK_NB
+ */
+
+#include <sys/sysmacros.h>
+/* makedev()
+ */
+
+#include <sys/resource.h>
+/* getrlimit()
+ * RLIMIT_NOFILE
+ * RLIM_INFINITY
+ */
+
+#ifdef __linux__
+#include <sys/syscall.h>
+/* syscall()
+ * __NR_io_uring_setup
+ * __NR_io_uring_enter
+ */
+
+#include <linux/io_uring.h>
+/* struct io_uring_params
+ * struct io_uring_sqe
+ * struct io_uring_cqe
+ * IORING_OP_STATX
+ * IORING_OFF_SQ_RING
+ * IORING_OFF_CQ_RING
+ * IORING_OFF_SQES
+ * IORING_ENTER_GETEVENTS
+ * IORING_FEAT_SINGLE_MMAP
+ */
+#endif
+
+#include <time.h>
+/* struct timespec
+ * clock_gettime()
+ * CLOCK_MONOTONIC
+ */
+
+#include <pthread.h>
+/* pthread_t
+ * pthread_mutex_t
+ * pthread_cond_t
+ * pthread_create()
+ * pthread_join()
+ * pthread_mutex_init()
+ * pthread_mutex_lock()
+ * pthread_mutex_unlock()
+ * pthread_mutex_destroy()
+ * pthread_condattr_t
+ * pthread_condattr_init()
+ * pthread_condattr_setclock()
+ * pthread_condattr_destroy()
+ * pthread_cond_init()
+ * pthread_cond_wait()
+ * pthread_cond_timedwait()
+ * pthread_cond_signal()
+ * pthread_cond_broadcast()
+ * pthread_cond_destroy()
+ */
+
+#include <stdatomic.h>
+/* atomic_size_t
+ * atomic_uint
+ * atomic_bool
+ * atomic_ullong
+ * atomic_init()
+ * atomic_store()
+ * atomic_compare_exchange_strong()
+ * atomic_fetch_add()
+ * atomic_fetch_add_explicit()
+ * atomic_fetch_sub()
+ * atomic_load()
+ * atomic_load_explicit()
+ * atomic_store_explicit()
+ * memory_order_relaxed
+ */
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+/* __m128i
+ * __m256i
+ * _mm_loadu_si128()
+ * _mm_storeu_si128()
+ * _mm_xor_si128()
+ * _mm_mul_epu32()
+ * _mm_shuffle_epi32()
+ * _mm_add_epi64()
+ * _mm256_loadu_si256()
+ * _mm256_storeu_si256()
+ * _mm256_xor_si256()
+ * _mm256_mul_epu32()
+ * _mm256_shuffle_epi32()
+ * _mm256_add_epi64()
+ * _MM_SHUFFLE()
+ */
+#endif
+
 
 /* definitions section */
 
+/* file status fields */
+#define SF_TYPE 1 /* file type */
+#define SF_ID 2 /* inode and device numbers */
+#define SF_SIZE 4 /* file size */
+#define SF_MTIME 8 /* modification time */
+#define SF_NOSYNC 16 /* don't synchronize attributes with a remote filesystem */
+#define SF_NLINK 32 /* number of hard links */
+
+/* the io_uring status pipeline needs statx and the io_uring system calls */
+#if defined(STATX_TYPE) && defined(__NR_io_uring_setup)
+#define USE_IO_URING
+#endif
+
+/* directory entries per status batch */
+#define BATCH_SIZE 64
+
+/* directory record pool, records have room for names in steps of DR_CLASS bytes */
+#define DR_CHUNK (1 << 16) /* bytes allocated at a time */
+#define DR_CLASS 16
+#define DR_CLASSES 17 /* enough for any directory entry name */
+
+/* default number of directories held open by a depth-first traversal */
+#define OPEN_DIRS 64
+
+/* bytes of directories read ahead by an ordered parallel traversal that are held in memory,
+ * the others wait in a temporary file */
+#define ORD_HELD (1 << 26)
+
+/* output buffer size */
+#define OUT_SIZE (1 << 20)
+
+/* initial input buffer size when the input can't be mapped */
+#define IN_SIZE (1 << 22)
+
+/* bytes of records a sort holds in memory, each run of that many is sorted and waits in a temporary file */
+#define SORT_RUN (1 << 28)
+
+/* smallest read buffer of a sorted run being merged */
+#define SORT_READ (1 << 16)
+
+/* file data read at a time for hashing, in a buffer aligned to pages */
+#define HASH_BUF (1 << 20)
+#define HASH_ALIGN 4096
+
+/* most files held open for hashing, at most half of the file descriptor limit */
+#define HASH_FDS 1024
+
+/* records an output buffer holds back while their files are hashed */
+#define HASH_WIN 1024
+
+/* data hashed at the head and at the tail of a duplicate candidate */
+#define DUP_SAMPLE 4096
+
+/* hash cache */
+#define HC_MAGIC "OUmhc1\n" /* file type and version */
+#define HC_HEAD 64 /* header size, the slots follow it */
+#define HC_SLOTS (1 << 16) /* smallest table */
+#define HC_PROBE 32 /* slots searched for a key */
+#define HC_KEEP 64 /* runs an unused entry survives compaction for */
+
+/* a front-coded manifest has a whole path at least this often */
+#define FC_RESTART 64
+
+/* path index file type and version */
+#define IX_MAGIC "OUmix1\n"
+
+/* kinds of operations counted in the run statistics */
+#define ST_NEXT 0 /* file list entries */
+#define ST_STAT 1 /* file status calls */
+#define ST_RECORD 2 /* files output */
+#define ST_HASH 3 /* files or pieces hashed */
+#define ST_READ 4 /* input manifest records */
+#define ST_WRITE 5 /* output manifest writes */
+#define ST_KINDS 6
+
+/* latency histogram buckets, by power of two of nanoseconds */
+#define ST_BUCKETS 40
+
+/* progress counters */
+#define PG_FOUND 0 /* directories found */
+#define PG_TAKEN 1 /* directories taken up for reading */
+#define PG_FILES 2 /* files listed */
+#define PG_QUEUED 3 /* bytes queued for hashing */
+#define PG_HASHED 4 /* bytes hashed */
+#define PG_KINDS 5
+
+/* default seconds between progress reports */
+#define PG_INTERVAL 10
+
+/* hash cache slot states */
+#define HC_EMPTY 0
+#define HC_BUSY 1
+#define HC_FULL 2
+
+/* XXH3 parameters */
+#define XXH_BUF 256 /* input held back by the hash state */
+#define XXH_SECRET 192 /* size of the default secret */
+#define XXH_SECRET_MIN 136
+#define XXH_PRIME32_1 0x9E3779B1U
+#define XXH_PRIME32_2 0x85EBCA77U
+#define XXH_PRIME32_3 0xC2B2AE3DU
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+
 /* program options */
 struct opt_struct {
 	bool verbose;
@@ -91,28 +381,302 @@ struct opt_struct {
 	bool update, add, remove, modified;
 
 	/* metadata types */
-	bool size, mtime;
+	bool size, mtime, hash,
+		links; /* refer to the first record of a file with several links */
 
 	/* symlink options */
 	bool cmd_lnk, /* follow symlinks specified in the command line */
 		all_lnk; /* follow all symlinks */
+
+	/* number of traversal threads */
+	unsigned int threads;
+
+	/* don't synchronize file attributes */
+	bool no_sync;
+
+	/* get file status through io_uring */
+	bool uring;
+
+	/* canonical record order */
+	bool canonical;
+
+	/* depth-first traversal in directory order */
+	bool depth_first;
+
+	/* directories held open at once by a depth-first traversal */
+	unsigned int open_dirs;
+
+	/* piece size for hashing files in pieces, 0 hashes whole files */
+	uintmax_t piece;
+
+	/* hash cache file, NULL if there is none */
+	char *cache_fn;
+
+	/* output sets of files with the same data instead of a manifest */
+	bool dups;
+
+	/* sort the input manifest instead */
+	bool sort;
+
+	/* path index file to write, and path index file to look up paths with, NULL if there is none */
+	char *index_fn, *lookup_fn;
+
+	/* front-coded paths in the output manifest */
+	bool front;
+
+	/* keep run statistics, and the file to write them to as JSON, NULL for a summary on standard error */
+	bool stats;
+	char *stats_fn;
+
+	/* seconds between progress reports, 0 for none, and the status file, NULL for standard error */
+	unsigned int progress;
+	char *progress_fn;
 };
 
 /* directory record */
 struct dir_rec {
-	char *path;
-	size_t ino_count;
-	ino_t *ino_list;
-	dev_t *dev_list;
+	/* name within the parent directory, the whole path for the first one */
+	char *name;
+	size_t len;
+
+	/* parent directory, the ancestors are shared by all their subdirectories */
+	struct dir_rec *parent;
+
+	/* references from this directory and its subdirectory records */
+	atomic_uint refs;
+
+	/* inode and device numbers, only known once the directory has been examined */
+	ino_t ino;
+	dev_t dev;
+	bool known;
+
+	/* size class in the record pool, the name follows the record */
+	unsigned char class;
+
+	/* next record in the traversal, or in the free list of the pool */
 	struct dir_rec *next;
 };
 
+/* pool of directory records, shared by the threads of a traversal */
+struct dr_pool {
+	pthread_mutex_t lock;
+
+	/* records put back, by size class */
+	struct dir_rec *free[DR_CLASSES];
+
+	/* chunks the records are carved from, and what is left of the newest one */
+	char **chunks;
+	size_t count, space;
+	char *next;
+	size_t left;
+};
+
+/* file identity */
+struct file_id {
+	dev_t dev;
+	ino_t ino;
+	bool used;
+};
+
+/* set of file identities */
+struct id_set {
+	pthread_mutex_t lock;
+	size_t count, space;
+	struct file_id *ids;
+};
+
+#ifdef USE_IO_URING
+/* io_uring instance */
+struct stat_ring {
+	int fd;
+
+	/* submission queue */
+	unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+	struct io_uring_sqe *sqes;
+
+	/* completion queue */
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	/* mappings */
+	void *sq_ptr, *cq_ptr;
+	size_t sq_len, cq_len, sqes_len;
+};
+
+/* directory entry waiting for its status */
+struct batch_ent {
+	/* offset of the name in the name buffer */
+	size_t name;
+
+	/* the directory entry type was enough */
+	bool quick;
+	mode_t mode;
+
+	/* status call result */
+	int res;
+	struct statx stx;
+};
+
+/* batch of directory entries */
+struct ent_batch {
+	size_t count, pos;
+	struct batch_ent ents[BATCH_SIZE];
+
+	/* entry names */
+	char *names;
+	size_t space;
+};
+#endif
+
+/* directory entry of a sorted traversal */
+struct sort_ent {
+	/* offset in the name buffer while reading, then the name itself */
+	size_t off;
+	char *name;
+
+	/* directory entry type */
+	unsigned char type;
+};
+
+/* open directory of a sorted traversal */
+struct dir_level {
+	struct dir_rec *dr;
+	DIR *dp;
+
+	/* directory path length */
+	size_t pre_len;
+
+	/* where reading goes on once a closed directory is opened again,
+	 * only in directory order as sorted entries are read ahead */
+	long loc;
+
+	/* entries sorted by name */
+	struct sort_ent *ents;
+	size_t count, pos, e_space;
+
+	char *names;
+	size_t n_space;
+};
+
+/* file of a directory read ahead by an ordered parallel traversal */
+struct ord_ent {
+	struct stat statbuf;
+
+	/* offset in the names of the directory, and the name itself */
+	size_t off;
+	char *name;
+
+	/* the directory it leads into, NULL if it is not gone into */
+	struct ord_dir *child;
+};
+
+/* directory of an ordered parallel traversal */
+struct ord_dir {
+	struct dir_rec *dr;
+
+	/* files sorted by name, followed by their names in the same block */
+	struct ord_ent *ents;
+	size_t count, size;
+
+	/* read ahead, and written to the temporary file at this offset instead of being held */
+	bool ready, spilled;
+	off_t off;
+
+	/* next directory waiting to be read */
+	struct ord_dir *next;
+};
+
+/* output position in a directory of an ordered parallel traversal */
+struct ord_level {
+	struct ord_dir *od;
+	size_t pos, pre_len;
+};
+
+/* traversal thread of an ordered parallel traversal */
+struct ord_worker {
+	pthread_t thread;
+	struct ord_trav *ot;
+	struct stat statbuf;
+	struct file_list_con *flc;
+
+	/* files and names of the directory being read */
+	struct ord_ent *ents;
+	size_t e_space;
+	char *names;
+	size_t n_space;
+};
+
+/* ordered parallel traversal, directories are read ahead by a pool of threads
+ * and their files are put back in canonical order */
+struct ord_trav {
+	pthread_mutex_t lock;
+	pthread_cond_t more, ready;
+
+	/* directories waiting to be read, the first in canonical order on top */
+	struct ord_dir *stack;
+
+	/* directories waiting or being read */
+	size_t pending;
+	bool done;
+
+	/* bytes of directories read ahead that are held, and the temporary file for the others */
+	size_t held;
+	FILE *spill;
+	off_t spill_end;
+
+	unsigned int count;
+	struct ord_worker *workers;
+
+	/* directories the output is in, and the one to go into next */
+	struct ord_level *levels;
+	size_t depth, l_space;
+	struct ord_dir *descend;
+};
+
+/* work-stealing deque of directory records */
+struct work_deque {
+	pthread_mutex_t lock;
+
+	/* circular buffer of directory records */
+	struct dir_rec **recs;
+	size_t space, top, count;
+};
+
+/* directory work pool */
+struct work_pool {
+	/* one deque per worker */
+	unsigned int count;
+	struct work_deque *deques;
+
+	/* directories waiting in the deques */
+	atomic_size_t queued;
+
+	/* directories waiting or being read */
+	atomic_size_t pending;
+
+	/* idle worker synchronization */
+	pthread_mutex_t idle_lock;
+	pthread_cond_t idle_cond;
+	atomic_uint idle;
+	bool done;
+};
+
 /* file list context */
 struct file_list_con {
 	bool verbose, follow_link;
 
-	/* files status buffer */
+	struct opt_struct *opts;
+
+	/* work pool and worker number (parallel traversal only) */
+	struct work_pool *pool;
+	unsigned int id;
+
+	/* files status buffer, only the type is valid without have_stat */
 	struct stat *statbuf;
+	bool have_stat;
+
+	/* file status fields to get */
+	unsigned int fields;
 
 	/* current directory */
 	struct dir_rec *c_dir;
@@ -120,6 +684,16 @@ struct file_list_con {
 	/* last directory */
 	struct dir_rec *l_dir;
 
+	/* where directory records come from */
+	struct dr_pool *drp;
+
+	/* directories already read when following symlinks */
+	struct id_set *visited;
+
+	/* current directory path */
+	size_t d_space;
+	char *d_path;
+
 	/* path prefix length */
 	size_t pre_len;
 
@@ -128,33 +702,437 @@ struct file_list_con {
 
 	char *f_path;
 
+	/* current file name */
+	char *name;
+
 	/* currently open directory */
 	DIR *dp;
+
+	/* depth-first traversal, with the files of each directory sorted or in directory order */
+	bool deep, sorted;
+	struct dir_level *levels;
+	size_t depth, l_space;
+
+	/* the directories of the lowest levels are closed, at most open_max are open */
+	size_t closed, open_max;
+
+	/* directory to go into next */
+	struct dir_rec *descend;
+
+	/* ordered parallel traversal, started with the first file */
+	bool ordered;
+	struct ord_trav *ord;
+
+#ifdef USE_IO_URING
+	/* status calls go through io_uring if this is not NULL */
+	struct stat_ring *ring;
+	struct ent_batch batch;
+#endif
 };
 
-/* hierarchy cache */
-struct h_cache {
+/* XXH3 64-bit hash state */
+struct xxh3 {
+	uint64_t acc[8];
 
+	/* bytes hashed, stripes accumulated in the current block */
+	uint64_t len;
+	unsigned int stripe;
+
+	/* input not accumulated yet, with the last accumulated stripe at the end */
+	unsigned char buf[XXH_BUF];
+	size_t buf_len;
 };
 
-/* file node record */
-struct node_record {
-	char *name;
-	size_t count;
-	struct node_record *child;
+/* file hash */
+struct hash_res {
+	bool ok;
+	uint64_t value;
+
+	/* piece hashes in piece mode */
+	uint64_t *piece;
+	size_t pieces, space;
+};
+
+/* record in an output window */
+struct hash_job {
+	/* next file in the hashing queue */
+	struct hash_job *next;
+
+	/* file path, or a copy of an input record */
+	char *text;
+	size_t len, space;
+	bool copy;
+
+	/* a copied record with a path is split into the fields before the path field, the path, and the fields after it */
+	size_t c_head, c_path;
+
+	struct stat statbuf;
+
+	/* file opened for hashing relative to its directory, shared by its pieces, -1 if it is not open */
+	int fd;
+
+	/* whether the file is hashed, and its hash */
+	bool hash;
+	struct hash_res res;
+	atomic_bool done;
+
+	/* file with several links, this is its first record */
+	struct link_ent *link;
+
+	/* path of the first record of the file, for a link reference */
+	char *ref;
+
+	/* pieces taken by hashing threads, pieces not hashed yet */
+	size_t taken, left;
+};
+
+/* file with several hard links */
+struct link_ent {
+	dev_t dev;
+	ino_t ino;
+
+	/* path of its first record */
+	char *path;
+
+	/* hash of the first record once it is done, records of other links waiting for it */
+	bool done;
+	struct hash_res res;
+	struct hash_job *waiting;
+};
+
+/* files with several hard links by identity, shared by output buffers */
+struct link_map {
+	pthread_mutex_t lock;
+	struct link_ent **ents;
+	size_t count, space;
+};
+
+/* hash cache file header */
+struct hc_head {
+	char magic[8];
+
+	/* number of slots, a power of two */
+	uint64_t slots;
+	atomic_ullong used;
+
+	/* number of runs that opened the cache */
+	atomic_uint gen;
+};
+
+/* hash cache slot, the key is everything but the hash and gen */
+struct hc_slot {
+	/* file identity, size, and modification time */
+	uint64_t dev, ino, size;
+	int64_t sec;
+	uint32_t nsec;
+
+	/* HC_EMPTY, HC_BUSY while it is written, or HC_FULL */
+	atomic_uint state;
+
+	/* piece size, 0 for the whole file, and piece number */
+	uint64_t piecesize, piece;
+
+	uint64_t hash;
+
+	/* last run that used it */
+	atomic_uint gen;
+};
+
+/* hash cache file mapped into memory, shared between runs */
+struct hash_cache {
+	int fd;
+	struct hc_head *head;
+	struct hc_slot *slots;
+	size_t len, mask;
+
+	/* this run */
+	unsigned int gen;
+
+	/* hashes were left out because the table was full */
+	atomic_bool full;
+	bool verbose;
+};
+
+/* pool of hashing threads */
+struct hash_pool {
+	struct opt_struct *opts;
+
+	/* hashes from earlier runs, NULL if there is no cache */
+	struct hash_cache *cache;
+
+	pthread_t *threads;
+	unsigned int count;
+
+	/* queue of files to hash */
+	struct hash_job *first, *last;
+	bool closing;
+
+	/* files held open by the queue, and the most there can be */
+	unsigned int fds, fd_max;
+
+	pthread_mutex_t lock;
+	pthread_cond_t more, /* files were queued or the pool is closing */
+		done; /* a file was hashed */
+};
+
+/* window of records that keeps the output order while files are hashed */
+struct hash_win {
+	struct hash_pool *hp;
+
+	/* ring of records, the oldest one is at the head */
+	struct hash_job jobs[HASH_WIN];
+	size_t head, count;
+};
+
+/* path index file header, the entries follow it sorted by path hash */
+struct ix_head {
+	char magic[8];
+
+	/* number of entries, and size of the manifest they point into */
+	uint64_t count, size;
+};
+
+/* path index entry */
+struct ix_ent {
+	/* hash of the path, and where its record begins in the manifest */
+	uint64_t hash, off;
+
+	/* where reading has to start for its path, an earlier record with a whole path in a front-coded manifest */
+	uint64_t start;
+};
+
+/* path index of the output manifest, built while it is written */
+struct path_index {
+	char *fn;
+	struct ix_ent *ents;
+	size_t count, space;
+};
+
+/* candidate file for the duplicate search */
+struct dup_ent {
+	char *path;
+	struct stat statbuf;
+
+	/* hashes of the head and tail, and of the whole data */
+	uint64_t sample, hash;
+	bool ok;
+};
+
+/* files collected for the duplicate search */
+struct dup_set {
+	struct opt_struct *opts;
+
+	pthread_mutex_t lock;
+	struct dup_ent *ents;
+	size_t count, space;
+
+	/* the next candidate to hash, and whether the whole data is hashed */
+	atomic_size_t next;
+	bool full;
+
+	/* hashes from earlier runs, NULL if there is no cache */
+	struct hash_cache *cache;
+};
+
+/* output file shared by output buffers */
+struct out_file {
+	int fd;
+	pthread_mutex_t lock;
+
+	/* bytes written so far */
+	uint64_t pos;
+
+	/* front-coded paths */
+	bool front;
+
+	/* path index of the records, NULL if there is none */
+	struct path_index *index;
+
+	/* hashing threads, NULL if files are not hashed */
+	struct hash_pool *hp;
+
+	/* files with several links, NULL if they are not tracked */
+	struct link_map *links;
+
+	/* duplicate search the files go to instead of records, NULL if they are output */
+	struct dup_set *dups;
 };
 
-/* filename list cache */
-struct l_cache {
+/* output buffer, only holds whole records */
+struct out_buf {
+	struct out_file *of;
+	char *buf;
+	size_t len, space;
+
+	/* records waiting for their files to be hashed */
+	struct hash_win *hw;
 
+	/* previous path in the buffer, and paths in the buffer so far, for front coding */
+	char *last;
+	size_t last_len, last_space, run;
+
+	/* path index entries of the buffer, at offsets within it */
+	struct ix_ent *ix_ents;
+	size_t ix_count, ix_space;
 };
 
-/* manifest record */
+/* manifest record, the pointers lead into the input */
 struct man_rec {
-	struct timespec mtime;
-	struct timespec atime;
+	/* the whole record */
+	char *rec;
+	size_t rec_len;
+
+	/* record type indicator */
+	char *type;
+	size_t type_len;
+
+	/* file path */
+	char *path;
+	size_t path_len;
+
+	/* the path field within the record, and the part of the path it shares with the previous one */
+	char *pfield;
+	size_t pfield_len, shared;
+
+	/* file metadata */
+	bool has_size, has_mtime, has_hash, has_phash, has_hmtime, has_hsize;
+	uintmax_t size, hsize;
+	struct timespec mtime, hmtime;
+
+	/* file hash, first of the consecutive piece hash fields and their number */
+	uint64_t hash;
+	char *phash;
+	size_t phashes;
+
+	/* hash record piece size */
+	bool has_piecesize;
+	uintmax_t piecesize;
+
+	/* ended by an empty field, end record */
+	bool closed, end;
+
+	/* header record that declares front-coded paths */
+	bool front_header;
+
+	/* paths are front-coded, the previous path and the one being decoded */
+	bool front;
+	char *prev, *cur;
+	size_t prev_len, prev_space, cur_space;
+};
+
+/* manifest reader */
+struct man_reader {
+	int fd;
+
+	/* mapped input file or streaming buffer */
+	char *buf;
+	size_t len, space, pos;
+	bool mapped;
+
+	/* end of the input, end of the manifest */
+	bool eof, done;
+
+	/* front-coded paths */
+	bool front;
+};
+
+/* lengths of a record being sorted, they go before its bytes in a sorted run */
+struct sort_len {
+	/* the fields before the path field, the path, and the fields after it */
+	size_t head, path, tail;
+
+	/* the record has a path, ended by an empty field */
+	bool has_path, closed;
+};
+
+/* record being sorted, its parts follow each other */
+struct sort_rec {
+	char *data;
+	struct sort_len len;
+};
+
+/* sorted run in the temporary file of a sort */
+struct sort_run {
+	/* part of the temporary file that is left */
+	off_t pos, end;
+
+	/* read buffer, and the first record that is left, with NULL data once there is none */
+	char *buf;
+	size_t len, at, space;
+	struct sort_rec cur;
+};
+
+/* external sort of a manifest */
+struct sort_con {
+	/* records held in memory and their bytes */
+	struct sort_rec *recs;
+	size_t count, r_space;
+	char *data;
+	size_t used, d_space;
+
+	/* temporary file and its write buffer */
+	FILE *tmp;
+	off_t end;
+	char *wbuf;
+	size_t wlen;
+
+	/* sorted runs in the temporary file */
+	struct sort_run *runs;
+	size_t r_count, runs_space;
+};
+
+/* statistics of one kind of operation */
+struct st_count {
+	uintmax_t calls, errors, bytes;
+
+	/* total time, and the calls by the power of two of their time in nanoseconds */
+	uint64_t ns;
+	uint64_t hist[ST_BUCKETS];
+};
+
+/* statistics of one thread, merged at the end of the run */
+struct st_thread {
+	struct st_count counts[ST_KINDS];
+	struct st_thread *next;
+};
+
+/* run statistics */
+struct st_set {
+	pthread_mutex_t lock;
+	struct st_thread *threads;
+
+	/* when the run started */
+	uint64_t start;
+};
+
+/* run statistics, NULL unless they are kept */
+struct st_set *stats = NULL;
+
+/* the counters of the running thread, made the first time it counts something */
+_Thread_local struct st_thread *st_mine = NULL;
+
+/* progress reporter */
+struct pg_set {
+	/* counters, only ever bumped with relaxed increments */
+	atomic_ullong counts[PG_KINDS];
+
+	/* reporter thread, woken early at the end of the run */
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	bool done;
+
+	unsigned int interval;
+
+	/* status file, -1 for standard error */
+	int fd;
+
+	uint64_t start;
 };
 
+/* progress reporter, NULL unless progress is reported */
+struct pg_set *progress = NULL;
+
 
 /* functions section */
 
@@ -177,23 +1155,296 @@ void failed(char *message)
 	fail(message);
 }
 
-/* help message */
-void help()
+/* monotonic time in nanoseconds */
+uint64_t st_now()
 {
-	char message[] = "Opal Manifest\n"
-	"version 1\n\n"
+	struct timespec ts;
 
-	"This program creates a manifest file containing metadata of files in a file hierarchy. The files are specified on the command line and the manifest file is output to standard output. A manifest file that needs to be updated can be input through standard input.\n\n"
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
 
-	"options\n"
-	"h: output help and exit\n"
-	"t: file types to output\n"
-	"u: update mode\n"
-	"m: types of metadata to include\n"
-	"H: archive the files pointed at by symlinks specified in the command line instead of the symlinks themselves\n"
-	"L: archive the files pointed at by all symlinks encountered in the hierarchy instead of the symlinks themselves\n\n"
+/* start timing an operation, the clock is only read if statistics are kept */
+uint64_t st_begin()
+{
+	return (stats != NULL) ? st_now() : 0;
+}
 
-	"The t, u, and m options are followed by characters that specify their behavior.\n\n"
+/* count an operation that started at the given time */
+void st_end(unsigned int kind, uint64_t start, bool error, uintmax_t bytes)
+{
+	unsigned int b;
+	uint64_t ns, t;
+	struct st_count *c;
+
+	if(stats == NULL) return;
+
+	if(st_mine == NULL)
+	{
+		if((st_mine = calloc(1, sizeof(struct st_thread))) == NULL) failed("allocate statistics");
+		pthread_mutex_lock(&stats->lock);
+		st_mine->next = stats->threads;
+		stats->threads = st_mine;
+		pthread_mutex_unlock(&stats->lock);
+	}
+
+	ns = st_now() - start;
+	c = &st_mine->counts[kind];
+	c->calls++;
+	if(error) c->errors++;
+	c->bytes += bytes;
+	c->ns += ns;
+
+	/* bucket b holds the times from 2^b to 2^(b+1) nanoseconds */
+	for(b = 0, t = ns >> 1; t && (b < ST_BUCKETS - 1); b++) t >>= 1;
+	c->hist[b]++;
+}
+
+/* add to a progress counter */
+void pg_count(unsigned int kind, uint64_t n)
+{
+	if(progress != NULL) atomic_fetch_add_explicit(&progress->counts[kind], n, memory_order_relaxed);
+}
+
+/* output a progress report, the counters and time are those of the last report */
+void pg_report(struct pg_set *pg, uint64_t *last, uint64_t *last_t)
+{
+	unsigned int k;
+	int len;
+	uint64_t now[PG_KINDS], t;
+	double secs, dt, rate;
+	char line[256];
+
+	t = st_now();
+	secs = (double)(t - pg->start) / 1e9;
+	dt = (double)(t - *last_t) / 1e9;
+	if(dt <= 0) dt = 1e-9;
+
+	for(k = 0; k < PG_KINDS; k++) now[k] = atomic_load_explicit(&pg->counts[k], memory_order_relaxed);
+
+	len = snprintf(line, sizeof(line), "progress %.0f s: %ju directories read, %ju queued, %ju files (%.0f/s)",
+		secs, (uintmax_t)now[PG_TAKEN], (uintmax_t)(now[PG_FOUND] > now[PG_TAKEN] ? now[PG_FOUND] - now[PG_TAKEN] : 0),
+		(uintmax_t)now[PG_FILES], (now[PG_FILES] - last[PG_FILES]) / dt);
+
+	/* the hashing backlog is known, the rest of the traversal is not */
+	if(now[PG_QUEUED])
+	{
+		rate = (now[PG_HASHED] - last[PG_HASHED]) / dt;
+		len += snprintf(line + len, sizeof(line) - len, ", hashed %.1f of %.1f MiB (%.1f MiB/s)",
+			now[PG_HASHED] / 1048576.0, now[PG_QUEUED] / 1048576.0, rate / 1048576.0);
+		if((rate > 0) && (now[PG_QUEUED] > now[PG_HASHED]))
+			len += snprintf(line + len, sizeof(line) - len, ", hash backlog eta %.0f s", (now[PG_QUEUED] - now[PG_HASHED]) / rate);
+	}
+
+	if(len > (int)sizeof(line) - 2) len = sizeof(line) - 2;
+	line[len++] = '\n';
+	line[len] = '\0';
+
+	/* the status file only holds the latest report */
+	if(pg->fd == -1) fputs(line, stderr);
+	else if((pwrite(pg->fd, line, len, 0) != len) || (ftruncate(pg->fd, len) == -1)) perror("progress file");
+
+	for(k = 0; k < PG_KINDS; k++) last[k] = now[k];
+	*last_t = t;
+}
+
+/* report progress at fixed intervals until the run is over */
+void * pg_main(void *arg)
+{
+	struct pg_set *pg = arg;
+	struct timespec ts;
+	uint64_t last[PG_KINDS], last_t;
+	bool done;
+
+	memset(last, 0, sizeof(last));
+	last_t = pg->start;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	pthread_mutex_lock(&pg->lock);
+
+	do
+	{
+		ts.tv_sec += pg->interval;
+		while((!pg->done) && (pthread_cond_timedwait(&pg->wake, &pg->lock, &ts) != ETIMEDOUT));
+		done = pg->done;
+
+		pthread_mutex_unlock(&pg->lock);
+		pg_report(pg, last, &last_t);
+		pthread_mutex_lock(&pg->lock);
+	}
+	while(!done);
+
+	pthread_mutex_unlock(&pg->lock);
+
+	return NULL;
+}
+
+/* start reporting progress */
+void pg_start(struct opt_struct *opts)
+{
+	unsigned int k;
+	pthread_condattr_t attr;
+
+	if((progress = malloc(sizeof(struct pg_set))) == NULL) failed("allocate progress reporter");
+	for(k = 0; k < PG_KINDS; k++) atomic_init(&progress->counts[k], 0);
+	progress->done = false;
+	progress->interval = opts->progress;
+	progress->start = st_now();
+
+	progress->fd = -1;
+	if(opts->progress_fn != NULL)
+		if((progress->fd = open(opts->progress_fn, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) == -1)
+			failed(opts->progress_fn);
+
+	/* the reporter waits on the same clock as the one it reports */
+	if(pthread_mutex_init(&progress->lock, NULL)) failed("initialize progress lock");
+	if(pthread_condattr_init(&attr) || pthread_condattr_setclock(&attr, CLOCK_MONOTONIC)
+		|| pthread_cond_init(&progress->wake, &attr))
+		failed("initialize progress condition");
+	pthread_condattr_destroy(&attr);
+
+	if(pthread_create(&progress->thread, NULL, pg_main, progress)) failed("create progress thread");
+}
+
+/* output the last progress report and stop */
+void pg_stop()
+{
+	pthread_mutex_lock(&progress->lock);
+	progress->done = true;
+	pthread_cond_signal(&progress->wake);
+	pthread_mutex_unlock(&progress->lock);
+
+	pthread_join(progress->thread, NULL);
+
+	if(progress->fd != -1) close(progress->fd);
+	pthread_cond_destroy(&progress->wake);
+	pthread_mutex_destroy(&progress->lock);
+	free(progress);
+	progress = NULL;
+}
+
+/* start keeping run statistics */
+void st_prep()
+{
+	if((stats = malloc(sizeof(struct st_set))) == NULL) failed("allocate statistics");
+	if(pthread_mutex_init(&stats->lock, NULL)) failed("initialize statistics lock");
+	stats->threads = NULL;
+	stats->start = st_now();
+}
+
+/* upper bound of the time of a fraction of the calls, in microseconds */
+double st_quantile(struct st_count *c, double q)
+{
+	unsigned int b;
+	uintmax_t n;
+
+	for(b = n = 0; b < ST_BUCKETS - 1; b++)
+		if((n += c->hist[b]) >= q * c->calls) break;
+
+	return (double)((uint64_t)2 << b) / 1000;
+}
+
+/* merge the statistics of all threads, output them, and stop keeping them */
+void st_report(struct opt_struct *opts)
+{
+	unsigned int k, b, count;
+	double wall;
+	FILE *fp;
+	struct st_thread *th, *next;
+	struct st_count total[ST_KINDS], *c;
+	char *names[ST_KINDS] = {"traverse", "status", "record", "hash", "read", "write"};
+
+	wall = (double)(st_now() - stats->start) / 1e9;
+
+	/* the threads are done, so their counters no longer change */
+	memset(total, 0, sizeof(total));
+	count = 0;
+	for(th = stats->threads; th != NULL; th = next)
+	{
+		for(k = 0; k < ST_KINDS; k++)
+		{
+			c = &th->counts[k];
+			total[k].calls += c->calls;
+			total[k].errors += c->errors;
+			total[k].bytes += c->bytes;
+			total[k].ns += c->ns;
+			for(b = 0; b < ST_BUCKETS; b++) total[k].hist[b] += c->hist[b];
+		}
+
+		next = th->next;
+		free(th);
+		count++;
+	}
+
+	if(opts->stats_fn == NULL)
+	{
+		fprintf(stderr, "statistics: %.3f s, %u threads\n", wall, count);
+		for(k = 0; k < ST_KINDS; k++)
+		{
+			c = &total[k];
+			if(c->calls == 0) continue;
+
+			fprintf(stderr, "%s: %ju calls, %ju errors, %ju bytes, %.3f s, mean %.1f us, median < %.1f us, 99%% < %.1f us\n",
+				names[k], c->calls, c->errors, c->bytes, (double)c->ns / 1e9, (double)c->ns / c->calls / 1000,
+				st_quantile(c, 0.5), st_quantile(c, 0.99));
+		}
+	}
+	else
+	{
+		if((fp = fopen(opts->stats_fn, "w")) == NULL) failed(opts->stats_fn);
+
+		fprintf(fp, "{\n\t\"seconds\": %.6f,\n\t\"threads\": %u", wall, count);
+		for(k = 0; k < ST_KINDS; k++)
+		{
+			c = &total[k];
+			fprintf(fp, ",\n\t\"%s\": {\"calls\": %ju, \"errors\": %ju, \"bytes\": %ju, \"seconds\": %.6f, \"histogram\": [",
+				names[k], c->calls, c->errors, c->bytes, (double)c->ns / 1e9);
+			for(b = 0; b < ST_BUCKETS; b++) fprintf(fp, b ? ", %ju" : "%ju", (uintmax_t)c->hist[b]);
+			fputs("]}", fp);
+		}
+		fputs("\n}\n", fp);
+
+		if(fclose(fp) == EOF) failed(opts->stats_fn);
+	}
+
+	pthread_mutex_destroy(&stats->lock);
+	free(stats);
+	stats = NULL;
+}
+
+/* help message */
+void help()
+{
+	char message[] = "Opal Manifest\n"
+	"version 1\n\n"
+
+	"This program creates a manifest file containing metadata of files in a file hierarchy. The files are specified on the command line and the manifest file is output to standard output. A manifest file that needs to be updated can be input through standard input.\n\n"
+
+	"options\n"
+	"h: output help and exit\n"
+	"t: file types to output\n"
+	"u: update mode\n"
+	"m: types of metadata to include\n"
+	"o: order of the records\n"
+	"O: most directories held open at once by a depth-first traversal (default 64)\n"
+	"H: archive the files pointed at by symlinks specified in the command line instead of the symlinks themselves\n"
+	"L: archive the files pointed at by all symlinks encountered in the hierarchy instead of the symlinks themselves\n"
+	"j: number of threads\n"
+	"D: don't synchronize file attributes with remote filesystems (Linux statx)\n"
+	"I: get file status through io_uring (Linux)\n"
+	"p: hash files in pieces of this size (K, M, or G suffix)\n"
+	"C: hash cache file kept between runs\n"
+	"d: duplicate mode, output the regular files that have the same data as another one\n"
+	"x: write a path index of the output manifest to this file\n"
+	"l: look up the paths on the command line with this path index file\n"
+	"f: front-code the paths of the output manifest\n"
+	"s: sort mode, sort the manifest on standard input into canonical order\n"
+	"S: output run statistics to standard error\n"
+	"J: write the run statistics as JSON to this file\n"
+	"P: report progress to standard error every this many seconds\n"
+	"F: write progress reports to this status file\n\n"
+
+	"The t, u, m, and o options are followed by characters that specify their behavior.\n\n"
 
 	"file type options\n"
 	"r: regular files\n"
@@ -210,432 +1461,5448 @@ void help()
 
 	"metadata type options\n"
 	"s: file size\n"
-	"m: modification time\n";
+	"m: modification time\n"
+	"h: hash of the file data (XXH3, 64 bits)\n"
+	"l: path of the first record of a file with several hard links\n\n"
+
+	"record order options\n"
+	"b: breadth-first (default)\n"
+	"c: canonical path order\n"
+	"d: depth-first in directory order\n";
 
 	fputs(message, stderr);
 }
 
-/* get file status */
-int get_stat(bool follow_link, char *fn, struct stat *statbuf, bool verbose)
+/* whether file data is hashed */
+bool hashing(struct opt_struct *opts)
+{
+	return opts->hash || opts->piece;
+}
+
+/* number of pieces a file is hashed in, an empty file still has one */
+uintmax_t file_pieces(struct stat *statbuf, struct opt_struct *opts)
+{
+	if(!opts->piece || (statbuf->st_size <= 0)) return 1;
+
+	return (statbuf->st_size - 1) / opts->piece + 1;
+}
+
+/* file status fields needed for the program options */
+unsigned int stat_fields(struct opt_struct *opts)
+{
+	unsigned int fields = SF_TYPE | SF_ID;
+
+	/* hashes are checked against the size and mtime in update mode */
+	if(opts->size || hashing(opts)) fields |= SF_SIZE;
+	if(opts->mtime || hashing(opts)) fields |= SF_MTIME;
+	if(opts->no_sync) fields |= SF_NOSYNC;
+
+	/* files with several links are hashed once */
+	if(opts->links || hashing(opts)) fields |= SF_NLINK;
+
+	return fields;
+}
+
+#ifdef STATX_TYPE
+/* statx flags */
+int stx_flags(bool follow_link, unsigned int fields)
+{
+	int flags;
+
+	flags = follow_link ? 0 : AT_SYMLINK_NOFOLLOW;
+	if(fields & SF_NOSYNC) flags |= AT_STATX_DONT_SYNC;
+
+	return flags;
+}
+
+/* statx mask, only the fields that will be used */
+unsigned int stx_mask(unsigned int fields)
+{
+	unsigned int mask = STATX_TYPE;
+
+	if(fields & SF_ID) mask |= STATX_INO;
+	if(fields & SF_SIZE) mask |= STATX_SIZE;
+	if(fields & SF_MTIME) mask |= STATX_MTIME;
+	if(fields & SF_NLINK) mask |= STATX_NLINK;
+
+	return mask;
+}
+
+/* copy statx results into a stat structure */
+void stx_conv(struct statx *stx, struct stat *statbuf)
+{
+	statbuf->st_mode = stx->stx_mode;
+	statbuf->st_nlink = stx->stx_nlink;
+	statbuf->st_ino = stx->stx_ino;
+	statbuf->st_dev = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+	statbuf->st_size = stx->stx_size;
+	statbuf->st_mtim.tv_sec = stx->stx_mtime.tv_sec;
+	statbuf->st_mtim.tv_nsec = stx->stx_mtime.tv_nsec;
+}
+
+/* get file status, relative to an open directory
+ * only the requested fields are filled in */
+int get_stat(bool follow_link, int dirfd, char *fn, struct stat *statbuf, unsigned int fields, bool verbose)
+{
+	int flags;
+	unsigned int mask;
+	uint64_t start;
+	struct statx stx;
+
+	/* if traversing the filesystem logically, get logical file status,
+	 * otherwise get physical file status */
+	flags = stx_flags(follow_link, fields);
+	mask = stx_mask(fields);
+
+	start = st_begin();
+	if(statx(dirfd, fn, flags, mask, &stx) == -1)
+	{
+		st_end(ST_STAT, start, true, 0);
+		if(verbose) perror(fn);
+		return -1;
+	}
+	st_end(ST_STAT, start, false, 0);
+
+	stx_conv(&stx, statbuf);
+
+	return 0;
+}
+#else
+/* get file status, relative to an open directory */
+int get_stat(bool follow_link, int dirfd, char *fn, struct stat *statbuf, unsigned int fields, bool verbose)
+{
+	uint64_t start;
+
+	/* if traversing the filesystem logically, get logical file status,
+	 * otherwise get physical file status */
+	start = st_begin();
+	if(fstatat(dirfd, fn, statbuf, follow_link ? 0 : AT_SYMLINK_NOFOLLOW) == -1)
+	{
+		st_end(ST_STAT, start, true, 0);
+		if(verbose) perror(fn);
+		return -1;
+	}
+
+	st_end(ST_STAT, start, false, 0);
+	return 0;
+}
+#endif
+
+/* file type indicator, NULL if the type is not output */
+char * file_type(struct stat *statbuf, struct opt_struct *opts)
+{
+	if(opts->regular && S_ISREG(statbuf->st_mode)) return "regular";
+	else if(opts->directory && S_ISDIR(statbuf->st_mode)) return "directory";
+	else if(opts->chr_dev && S_ISCHR(statbuf->st_mode)) return "character";
+	else if(opts->blk_dev && S_ISBLK(statbuf->st_mode)) return "block";
+	else if(opts->symlink && S_ISLNK(statbuf->st_mode)) return "symlink";
+	else if(opts->fifo && S_ISFIFO(statbuf->st_mode)) return "fifo";
+	else return NULL;
+}
+
+#ifdef USE_IO_URING
+/* free io_uring instance */
+void ring_free(struct stat_ring *ring)
 {
-	/* if traversing the filesystem logically */
-	if(follow_link)
+	if(ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqes_len);
+	if((ring->cq_ptr != MAP_FAILED) && (ring->cq_ptr != ring->sq_ptr)) munmap(ring->cq_ptr, ring->cq_len);
+	if(ring->sq_ptr != MAP_FAILED) munmap(ring->sq_ptr, ring->sq_len);
+	close(ring->fd);
+	free(ring);
+}
+
+/* submit the queued requests and wait for completions */
+int ring_enter(struct stat_ring *ring, unsigned int submit, unsigned int wait)
+{
+	return syscall(__NR_io_uring_enter, ring->fd, submit, wait, IORING_ENTER_GETEVENTS, NULL, 0);
+}
+
+/* queue a statx request */
+void ring_statx(struct stat_ring *ring, int dirfd, char *fn, int flags, unsigned int mask, struct statx *stx, size_t data)
+{
+	unsigned int tail, index;
+	struct io_uring_sqe *sqe;
+
+	tail = *ring->sq_tail;
+	index = tail & *ring->sq_mask;
+	sqe = &ring->sqes[index];
+
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	sqe->opcode = IORING_OP_STATX;
+	sqe->fd = dirfd;
+	sqe->addr = (uintptr_t)fn;
+	sqe->len = mask;
+	sqe->off = (uintptr_t)stx;
+	sqe->statx_flags = flags;
+	sqe->user_data = data;
+
+	ring->sq_array[index] = index;
+	atomic_store_explicit((_Atomic unsigned int *)ring->sq_tail, tail + 1, memory_order_release);
+}
+
+/* take a completion, returns false if there is none */
+bool ring_reap(struct stat_ring *ring, size_t *data, int *res)
+{
+	unsigned int head;
+	struct io_uring_cqe *cqe;
+
+	head = *ring->cq_head;
+	if(head == atomic_load_explicit((_Atomic unsigned int *)ring->cq_tail, memory_order_acquire))
+		return false;
+
+	cqe = &ring->cqes[head & *ring->cq_mask];
+	*data = cqe->user_data;
+	*res = cqe->res;
+
+	atomic_store_explicit((_Atomic unsigned int *)ring->cq_head, head + 1, memory_order_release);
+
+	return true;
+}
+
+/* set up io_uring instance, NULL if io_uring or its statx operation is unavailable */
+struct stat_ring * ring_prep(bool verbose)
+{
+	size_t data;
+	int res;
+	struct stat_ring *ring;
+	struct io_uring_params p;
+	struct statx stx;
+
+	if((ring = malloc(sizeof(struct stat_ring))) == NULL) failed("allocate io_uring");
+	ring->sq_ptr = ring->cq_ptr = ring->sqes = MAP_FAILED;
+
+	memset(&p, 0, sizeof(p));
+	if((ring->fd = syscall(__NR_io_uring_setup, BATCH_SIZE, &p)) == -1)
+	{
+		if(verbose) perror("io_uring");
+		free(ring);
+		return NULL;
+	}
+
+	/* map the rings */
+	ring->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	ring->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if(p.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if(ring->cq_len > ring->sq_len) ring->sq_len = ring->cq_len;
+		ring->cq_len = ring->sq_len;
+	}
+
+	ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if(ring->sq_ptr == MAP_FAILED) {ring_free(ring); return NULL;}
+
+	if(p.features & IORING_FEAT_SINGLE_MMAP) ring->cq_ptr = ring->sq_ptr;
+	else
+	{
+		ring->cq_ptr = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+		if(ring->cq_ptr == MAP_FAILED) {ring_free(ring); return NULL;}
+	}
+
+	ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if(ring->sqes == MAP_FAILED) {ring_free(ring); return NULL;}
+
+	ring->sq_head = (unsigned int *)((char *)ring->sq_ptr + p.sq_off.head);
+	ring->sq_tail = (unsigned int *)((char *)ring->sq_ptr + p.sq_off.tail);
+	ring->sq_mask = (unsigned int *)((char *)ring->sq_ptr + p.sq_off.ring_mask);
+	ring->sq_array = (unsigned int *)((char *)ring->sq_ptr + p.sq_off.array);
+	ring->cq_head = (unsigned int *)((char *)ring->cq_ptr + p.cq_off.head);
+	ring->cq_tail = (unsigned int *)((char *)ring->cq_ptr + p.cq_off.tail);
+	ring->cq_mask = (unsigned int *)((char *)ring->cq_ptr + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)((char *)ring->cq_ptr + p.cq_off.cqes);
+
+	/* make sure the kernel knows the statx operation */
+	ring_statx(ring, AT_FDCWD, ".", 0, STATX_TYPE, &stx, 0);
+	if((ring_enter(ring, 1, 1) == -1) || (!ring_reap(ring, &data, &res)) || (res < 0))
+	{
+		if(verbose) fputs("io_uring statx is unavailable\n", stderr);
+		ring_free(ring);
+		return NULL;
+	}
+
+	return ring;
+}
+#endif
+
+/* open a directory stream, NULL means the working directory */
+DIR * dir_open(char *path)
+{
+	int fd;
+	DIR *dp;
+
+	if((fd = open(path != NULL ? path : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1)
+		return NULL;
+
+	if((dp = fdopendir(fd)) == NULL) close(fd);
+
+	return dp;
+}
+
+/* initialize work pool */
+void wp_init(struct work_pool *pool, unsigned int count)
+{
+	unsigned int i;
+	struct work_deque *wd;
+
+	pool->count = count;
+	if((pool->deques = malloc(count * sizeof(struct work_deque))) == NULL)
+		failed("allocate work deques");
+
+	for(i = 0; i < count; i++)
+	{
+		wd = &pool->deques[i];
+		if(pthread_mutex_init(&wd->lock, NULL)) failed("initialize work deque lock");
+		wd->recs = NULL;
+		wd->space = wd->top = wd->count = 0;
+	}
+
+	pool->queued = 0;
+	pool->pending = 0;
+	pool->idle = 0;
+	pool->done = false;
+
+	if(pthread_mutex_init(&pool->idle_lock, NULL)) failed("initialize idle lock");
+	if(pthread_cond_init(&pool->idle_cond, NULL)) failed("initialize idle condition");
+}
+
+/* free work pool */
+void wp_free(struct work_pool *pool)
+{
+	unsigned int i;
+
+	for(i = 0; i < pool->count; i++)
+	{
+		pthread_mutex_destroy(&pool->deques[i].lock);
+		free(pool->deques[i].recs);
+	}
+
+	free(pool->deques);
+	pthread_mutex_destroy(&pool->idle_lock);
+	pthread_cond_destroy(&pool->idle_cond);
+}
+
+/* push directory record onto the bottom of a deque */
+void wd_push(struct work_deque *wd, struct dir_rec *dr)
+{
+	size_t i, space;
+	struct dir_rec **recs;
+
+	pthread_mutex_lock(&wd->lock);
+
+	/* grow the circular buffer */
+	if(wd->count == wd->space)
+	{
+		space = wd->space ? wd->space * 2 : 64;
+		if((recs = malloc(space * sizeof(struct dir_rec *))) == NULL)
+			failed("allocate work deque");
+		for(i = 0; i < wd->count; i++)
+			recs[i] = wd->recs[(wd->top + i) % wd->space];
+		free(wd->recs);
+		wd->recs = recs;
+		wd->space = space;
+		wd->top = 0;
+	}
+
+	wd->recs[(wd->top + wd->count++) % wd->space] = dr;
+
+	pthread_mutex_unlock(&wd->lock);
+}
+
+/* pop directory record from the bottom of a deque (owner end) */
+struct dir_rec * wd_pop(struct work_deque *wd)
+{
+	struct dir_rec *dr = NULL;
+
+	pthread_mutex_lock(&wd->lock);
+
+	if(wd->count)
+		dr = wd->recs[(wd->top + --wd->count) % wd->space];
+
+	pthread_mutex_unlock(&wd->lock);
+
+	return dr;
+}
+
+/* steal directory record from the top of a deque */
+struct dir_rec * wd_steal(struct work_deque *wd)
+{
+	struct dir_rec *dr = NULL;
+
+	pthread_mutex_lock(&wd->lock);
+
+	if(wd->count)
+	{
+		dr = wd->recs[wd->top];
+		wd->top = (wd->top + 1) % wd->space;
+		wd->count--;
+	}
+
+	pthread_mutex_unlock(&wd->lock);
+
+	return dr;
+}
+
+/* add directory to the work pool */
+void wp_put(struct work_pool *pool, unsigned int id, struct dir_rec *dr)
+{
+	atomic_fetch_add(&pool->pending, 1);
+	wd_push(&pool->deques[id], dr);
+	atomic_fetch_add(&pool->queued, 1);
+
+	/* wake an idle worker */
+	if(atomic_load(&pool->idle))
+	{
+		pthread_mutex_lock(&pool->idle_lock);
+		pthread_cond_signal(&pool->idle_cond);
+		pthread_mutex_unlock(&pool->idle_lock);
+	}
+}
+
+/* get directory from the work pool, wait if there is none */
+struct dir_rec * wp_get(struct work_pool *pool, unsigned int id)
+{
+	unsigned int i;
+	struct dir_rec *dr;
+
+	while(true)
 	{
-		/* get logical file status */
-		if(stat(fn, statbuf) == -1)
+		/* take from own deque, then steal from the others */
+		if((dr = wd_pop(&pool->deques[id])) == NULL)
+			for(i = 1; i < pool->count; i++)
+				if((dr = wd_steal(&pool->deques[(id + i) % pool->count])) != NULL)
+					break;
+
+		if(dr != NULL)
 		{
-			if(verbose) perror(fn);
-			return -1;
+			atomic_fetch_sub(&pool->queued, 1);
+			return dr;
+		}
+
+		/* wait for more work or the end of the traversal */
+		pthread_mutex_lock(&pool->idle_lock);
+		atomic_fetch_add(&pool->idle, 1);
+		while((!pool->done) && (atomic_load(&pool->queued) == 0))
+			pthread_cond_wait(&pool->idle_cond, &pool->idle_lock);
+		atomic_fetch_sub(&pool->idle, 1);
+
+		if(pool->done)
+		{
+			pthread_mutex_unlock(&pool->idle_lock);
+			return NULL;
 		}
-		else return 0;
+
+		pthread_mutex_unlock(&pool->idle_lock);
+	}
+}
+
+/* finish a directory taken from the work pool */
+void wp_finish(struct work_pool *pool)
+{
+	/* if that was the last directory, release all workers */
+	if(atomic_fetch_sub(&pool->pending, 1) == 1)
+	{
+		pthread_mutex_lock(&pool->idle_lock);
+		pool->done = true;
+		pthread_cond_broadcast(&pool->idle_cond);
+		pthread_mutex_unlock(&pool->idle_lock);
 	}
+}
+
+/* hash of a file identity */
+size_t id_hash(dev_t dev, ino_t ino)
+{
+	uint64_t h;
+
+	h = ((uint64_t)ino * 0x9E3779B97F4A7C15u) ^ ((uint64_t)dev * 0xC2B2AE3D27D4EB4Fu);
+
+	return h ^ (h >> 29);
+}
+
+/* prepare file identity set */
+struct id_set * ids_prep(void)
+{
+	struct id_set *set;
+
+	if((set = malloc(sizeof(struct id_set))) == NULL) failed("allocate file identity set");
+	if(pthread_mutex_init(&set->lock, NULL)) failed("initialize file identity set lock");
+
+	set->count = 0;
+	set->space = 1024;
+	if((set->ids = calloc(set->space, sizeof(struct file_id))) == NULL)
+		failed("allocate file identity table");
+
+	return set;
+}
+
+/* free file identity set */
+void ids_free(struct id_set *set)
+{
+	pthread_mutex_destroy(&set->lock);
+	free(set->ids);
+	free(set);
+}
+
+/* find the slot of a file identity */
+struct file_id * ids_slot(struct file_id *ids, size_t space, dev_t dev, ino_t ino)
+{
+	size_t i;
+
+	/* linear probing, space is a power of two */
+	for(i = id_hash(dev, ino) & (space - 1); ids[i].used; i = (i + 1) & (space - 1))
+		if((ids[i].ino == ino) && (ids[i].dev == dev)) break;
+
+	return &ids[i];
+}
+
+/* add file identity to set, returns false if it was already there */
+bool ids_add(struct id_set *set, dev_t dev, ino_t ino)
+{
+	size_t i;
+	struct file_id *ids, *slot;
+
+	pthread_mutex_lock(&set->lock);
+
+	/* keep the table at most half full */
+	if((set->count + 1) * 2 > set->space)
+	{
+		if((ids = calloc(set->space * 2, sizeof(struct file_id))) == NULL)
+			failed("allocate file identity table");
+		for(i = 0; i < set->space; i++)
+			if(set->ids[i].used)
+				*ids_slot(ids, set->space * 2, set->ids[i].dev, set->ids[i].ino) = set->ids[i];
+		free(set->ids);
+		set->ids = ids;
+		set->space *= 2;
+	}
+
+	slot = ids_slot(set->ids, set->space, dev, ino);
+
+	if(slot->used)
+	{
+		pthread_mutex_unlock(&set->lock);
+		return false;
+	}
+
+	slot->dev = dev;
+	slot->ino = ino;
+	slot->used = true;
+	set->count++;
+
+	pthread_mutex_unlock(&set->lock);
+
+	return true;
+}
+
+/* prepare directory record pool */
+struct dr_pool * drp_prep(void)
+{
+	struct dr_pool *drp;
+
+	if((drp = calloc(1, sizeof(struct dr_pool))) == NULL) failed("allocate directory record pool");
+	if(pthread_mutex_init(&drp->lock, NULL)) failed("initialize directory record pool lock");
+
+	return drp;
+}
+
+/* free directory record pool, along with all of its records */
+void drp_free(struct dr_pool *drp)
+{
+	size_t i;
+
+	for(i = 0; i < drp->count; i++) free(drp->chunks[i]);
+	free(drp->chunks);
+	pthread_mutex_destroy(&drp->lock);
+	free(drp);
+}
+
+/* allocate directory record with room for a name of len bytes,
+ * records come from the free list of their size class, or from the newest chunk */
+struct dir_rec * dr_alloc(struct dr_pool *drp, size_t len)
+{
+	struct dir_rec *dr;
+	size_t class, size;
+
+	class = (len + DR_CLASS) / DR_CLASS;
+	size = sizeof(struct dir_rec) + class * DR_CLASS;
+
+	/* a long first directory path gets a record of its own */
+	if(class >= DR_CLASSES)
+	{
+		if((dr = malloc(size)) == NULL) failed("allocate directory record");
+		dr->class = DR_CLASSES;
+		dr->name = (char *)(dr + 1);
+		return dr;
+	}
+
+	pthread_mutex_lock(&drp->lock);
+
+	if((dr = drp->free[class]) != NULL) drp->free[class] = dr->next;
+
+	else
+	{
+		if(drp->left < size)
+		{
+			if(drp->count == drp->space)
+				if((drp->chunks = realloc(drp->chunks, (drp->space = drp->space ? drp->space * 2 : 64) * sizeof(char *))) == NULL)
+					failed("allocate directory record pool");
+
+			if((drp->next = malloc(DR_CHUNK)) == NULL) failed("allocate directory record pool");
+			drp->chunks[drp->count++] = drp->next;
+			drp->left = DR_CHUNK;
+		}
+
+		dr = (struct dir_rec *)drp->next;
+		drp->next += size;
+		drp->left -= size;
+	}
+
+	pthread_mutex_unlock(&drp->lock);
+
+	dr->class = class;
+	dr->name = (char *)(dr + 1);
+
+	return dr;
+}
+
+/* put a directory record back for reuse */
+void dr_free(struct dr_pool *drp, struct dir_rec *dr)
+{
+	if(dr->class == DR_CLASSES)
+	{
+		free(dr);
+		return;
+	}
+
+	pthread_mutex_lock(&drp->lock);
+	dr->next = drp->free[dr->class];
+	drp->free[dr->class] = dr;
+	pthread_mutex_unlock(&drp->lock);
+}
+
+/* create first directory record */
+struct dir_rec * dr_root(struct dr_pool *drp, char *root, struct stat *statbuf)
+{
+	struct dir_rec *f_dir;
+
+	if(root != NULL)
+	{
+		/* allocate first directory record and store its name */
+		f_dir = dr_alloc(drp, strlen(root));
+		f_dir->len = strlen(root);
+		memcpy(f_dir->name, root, f_dir->len + 1);
+	}
+	else
+	{
+		f_dir = dr_alloc(drp, 0);
+		f_dir->name = NULL;
+		f_dir->len = 0;
+	}
+
+	f_dir->parent = NULL;
+	f_dir->refs = 1;
+	f_dir->ino = statbuf->st_ino;
+	f_dir->dev = statbuf->st_dev;
+	f_dir->known = true;
+
+	/* terminate linked list */
+	f_dir->next = NULL;
+
+	pg_count(PG_FOUND, 1);
+	return f_dir;
+}
+
+/* release directory record, along with ancestors no longer needed */
+void dr_release(struct dr_pool *drp, struct dir_rec *dr)
+{
+	struct dir_rec *parent;
+
+	while((dr != NULL) && (atomic_fetch_sub(&dr->refs, 1) == 1))
+	{
+		parent = dr->parent;
+		dr_free(drp, dr);
+		dr = parent;
+	}
+}
+
+/* path of the current file */
+char * fl_path(struct file_list_con *flc)
+{
+	size_t com_len, n_len;
+
+	/* allocate space for the file path */
+	n_len = strlen(flc->name);
+	com_len = flc->pre_len + n_len + 2;
+	if(flc->space < com_len)
+		if((flc->f_path = realloc(flc->f_path, flc->space = com_len)) == NULL)
+			failed("allocate file path");
+
+	/* put together path */
+	if(flc->pre_len)
+	{
+		memcpy(flc->f_path, flc->d_path, flc->pre_len);
+		flc->f_path[flc->pre_len] = '/';
+		memcpy(flc->f_path + flc->pre_len + 1, flc->name, n_len + 1);
+	}
+	else memcpy(flc->f_path, flc->name, n_len + 1);
+
+	return flc->f_path;
+}
+
+/* open directory the current file name is relative to, -1 if it is not open anymore */
+int fl_dirfd(struct file_list_con *flc)
+{
+	/* the files of an ordered traversal come out after their directory was read */
+	if(flc->ordered) return -1;
+
+	if(flc->deep) return (flc->depth > flc->closed) ? dirfd(flc->levels[flc->depth - 1].dp) : -1;
+
+	return (flc->dp != NULL) ? dirfd(flc->dp) : -1;
+}
+
+/* put together the path of the current directory from its ancestors,
+ * returns NULL for the working directory */
+char * fl_dpath(struct file_list_con *flc)
+{
+	size_t len, pos;
+	struct dir_rec *dr;
+
+	/* measure the path */
+	len = 0;
+	for(dr = flc->c_dir; dr != NULL; dr = dr->parent)
+		if(dr->name != NULL) len += dr->len + 1;
+
+	if(len == 0)
+	{
+		flc->pre_len = 0;
+		return NULL;
+	}
+
+	/* allocate space for the directory path */
+	if(flc->d_space < len)
+		if((flc->d_path = realloc(flc->d_path, flc->d_space = len)) == NULL)
+			failed("allocate directory path");
+
+	/* fill in the path from the end */
+	pos = flc->pre_len = len - 1;
+	flc->d_path[pos] = '\0';
+
+	for(dr = flc->c_dir; dr != NULL; dr = dr->parent)
+	{
+		if(dr->name == NULL) continue;
+
+		pos -= dr->len;
+		memcpy(flc->d_path + pos, dr->name, dr->len);
+		if(pos) flc->d_path[--pos] = '/';
+	}
+
+	return flc->d_path;
+}
+
+/* check a newly examined directory, returns false if it should be skipped */
+bool dr_check(struct file_list_con *flc, struct dir_rec *dr, ino_t ino, dev_t dev, char *path)
+{
+	struct dir_rec *a_dir;
+
+	dr->ino = ino;
+	dr->dev = dev;
+	dr->known = true;
+
+	/* when following symlinks, each directory is only read once */
+	if((flc->visited != NULL) && ids_add(flc->visited, dev, ino)) return true;
+
+	/* check for infinite directory loop */
+	for(a_dir = dr->parent; a_dir != NULL; a_dir = a_dir->parent)
+		if(ino == a_dir->ino)
+			if(dev == a_dir->dev)
+				fail("infinite directory loop");
+
+	/* the directory was already reached through another symlink */
+	if(flc->visited != NULL)
+	{
+		if(flc->verbose) fprintf(stderr, "%s: directory already visited\n", path);
+		return false;
+	}
+
+	return true;
+}
+
+/* create directory record for the current file, NULL if it is skipped */
+struct dir_rec * dr_new(struct file_list_con *flc)
+{
+	struct dir_rec *c_dir, *n_dir;
+
+	c_dir = flc->c_dir;
+
+	/* allocate new directory record, with its name */
+	n_dir = dr_alloc(flc->drp, strlen(flc->name));
+	n_dir->len = strlen(flc->name);
+	memcpy(n_dir->name, flc->name, n_dir->len + 1);
+
+	/* the parent is kept until all its subdirectories are done */
+	n_dir->parent = c_dir;
+	atomic_fetch_add(&c_dir->refs, 1);
+	n_dir->refs = 1;
+
+	n_dir->next = NULL;
+
+	/* without file status, the check waits until the directory is opened */
+	n_dir->known = false;
+	if(flc->have_stat)
+		if(!dr_check(flc, n_dir, flc->statbuf->st_ino, flc->statbuf->st_dev, fl_path(flc)))
+		{
+			dr_release(flc->drp, n_dir);
+			return NULL;
+		}
+
+	pg_count(PG_FOUND, 1);
+	return n_dir;
+}
+
+/* add directory record */
+void dr_add(struct file_list_con *flc)
+{
+	struct dir_rec *n_dir;
+
+	if((n_dir = dr_new(flc)) == NULL) return;
+
+	/* hand the directory to the work pool */
+	if(flc->pool != NULL) wp_put(flc->pool, flc->id, n_dir);
+
+	/* or append it to the linked list */
+	else flc->l_dir = flc->l_dir->next = n_dir;
+}
+
+/* get next directory record */
+struct dir_rec * dr_next(struct dr_pool *drp, struct dir_rec *c_dir)
+{
+	struct dir_rec *n_dir;
+
+	n_dir = c_dir->next;
+	dr_release(drp, c_dir);
+
+	return n_dir;
+}
+
+/* leave the current directory of a depth-first traversal */
+void fl_pop(struct file_list_con *flc)
+{
+	struct dir_level *lv;
+
+	lv = &flc->levels[--flc->depth];
+	if(lv->dp != NULL) closedir(lv->dp);
+	if(flc->closed > flc->depth) flc->closed = flc->depth;
+	dr_release(flc->drp, lv->dr);
+
+	if(flc->depth)
+	{
+		lv = &flc->levels[flc->depth - 1];
+		flc->c_dir = lv->dr;
+		flc->pre_len = lv->pre_len;
+		flc->d_path[flc->pre_len] = '\0';
+	}
+	else flc->c_dir = NULL;
+}
+
+/* free the buffers of a file list context */
+void fl_free(struct file_list_con *flc)
+{
+	size_t i;
+
+	for(i = 0; i < flc->l_space; i++)
+	{
+		free(flc->levels[i].ents);
+		free(flc->levels[i].names);
+	}
+	free(flc->levels);
+
+#ifdef USE_IO_URING
+	if(flc->ring != NULL) ring_free(flc->ring);
+	free(flc->batch.names);
+#endif
+
+	free(flc->d_path);
+	free(flc->f_path);
+	free(flc);
+}
+
+/* bring back the files of a directory that was written to the temporary file */
+void ord_load(struct ord_trav *ot, struct ord_dir *od)
+{
+	size_t i;
+	char *names;
+
+	if((!od->spilled) || (od->ents != NULL)) return;
+
+	if((od->ents = malloc(od->size)) == NULL) failed("allocate directory entries");
+	if(pread(fileno(ot->spill), od->ents, od->size, od->off) != (ssize_t)od->size)
+		failed("read directory entries back from the temporary file");
+
+	names = (char *)(od->ents + od->count);
+	for(i = 0; i < od->count; i++) od->ents[i].name = names + od->ents[i].off;
+}
+
+/* free a directory of an ordered parallel traversal, along with the directories
+ * of its files from the given one on */
+void ord_drop(struct ord_trav *ot, struct ord_dir *od, size_t from, struct dr_pool *drp)
+{
+	size_t i;
+
+	if(od->ready)
+	{
+		ord_load(ot, od);
+		for(i = from; i < od->count; i++)
+			if(od->ents[i].child != NULL) ord_drop(ot, od->ents[i].child, 0, drp);
+	}
+
+	free(od->ents);
+	dr_release(drp, od->dr);
+	free(od);
+}
+
+/* stop an ordered parallel traversal, and free what was not output */
+void ord_close(struct file_list_con *flc)
+{
+	unsigned int i;
+	struct ord_trav *ot = flc->ord;
+	struct ord_level *lv;
+
+	pthread_mutex_lock(&ot->lock);
+	ot->done = true;
+	pthread_cond_broadcast(&ot->more);
+	pthread_mutex_unlock(&ot->lock);
+
+	for(i = 0; i < ot->count; i++)
+	{
+		pthread_join(ot->workers[i].thread, NULL);
+		fl_free(ot->workers[i].flc);
+		free(ot->workers[i].ents);
+		free(ot->workers[i].names);
+	}
+	free(ot->workers);
+
+	/* the directories waiting to be read are below the ones being output */
+	if(ot->descend != NULL) ord_drop(ot, ot->descend, 0, flc->drp);
+	while(ot->depth)
+	{
+		lv = &ot->levels[--ot->depth];
+		ord_drop(ot, lv->od, lv->pos, flc->drp);
+	}
+	free(ot->levels);
+
+	if(ot->spill != NULL) fclose(ot->spill);
+	pthread_cond_destroy(&ot->ready);
+	pthread_cond_destroy(&ot->more);
+	pthread_mutex_destroy(&ot->lock);
+	free(ot);
+	flc->ord = NULL;
+}
+
+/* close file list */
+void fl_close(struct file_list_con *flc)
+{
+	if(flc->dp != NULL) closedir(flc->dp);
+
+	/* leave the directories of a depth-first traversal */
+	if(flc->descend != NULL) dr_release(flc->drp, flc->descend);
+	while(flc->depth) fl_pop(flc);
+	if(flc->ord != NULL) ord_close(flc);
+
+	/* a worker's last directory is released when the pool runs dry,
+	 * the records of workers are in a pool they share */
+	if(flc->pool == NULL)
+	{
+		while(flc->c_dir != NULL) flc->c_dir = dr_next(flc->drp, flc->c_dir);
+		drp_free(flc->drp);
+	}
+
+	fl_free(flc);
+}
+
+/* allocate file list context */
+struct file_list_con * fl_alloc(struct stat *statbuf, struct opt_struct *opts)
+{
+	struct file_list_con *flc;
+
+	/* allocate new file list context */
+	if((flc = malloc(sizeof(struct file_list_con))) == NULL) failed("allocate file list context");
+
+	flc->verbose = opts->verbose;
+	flc->follow_link = opts->all_lnk;
+	flc->opts = opts;
+	flc->have_stat = true;
+	flc->fields = stat_fields(opts);
+	flc->pool = NULL;
+	flc->id = 0;
+	flc->statbuf = statbuf;
+	flc->space = 0;
+	flc->f_path = NULL;
+	flc->visited = NULL;
+	flc->d_space = 0;
+	flc->d_path = NULL;
+	flc->l_dir = flc->c_dir = NULL;
+	flc->pre_len = 0;
+	flc->dp = NULL;
+	flc->deep = flc->sorted = false;
+	flc->levels = NULL;
+	flc->depth = flc->l_space = 0;
+	flc->closed = 0;
+	flc->open_max = opts->open_dirs;
+	flc->descend = NULL;
+	flc->ordered = false;
+	flc->ord = NULL;
+	flc->drp = NULL;
+
+#ifdef USE_IO_URING
+	/* fall back to plain status calls if io_uring is unavailable */
+	flc->ring = opts->uring ? ring_prep(opts->verbose) : NULL;
+	flc->batch.count = flc->batch.pos = 0;
+	flc->batch.names = NULL;
+	flc->batch.space = 0;
+#endif
+
+	return flc;
+}
+
+/* prepare file list */
+struct file_list_con * fl_prep(char *root, struct stat *statbuf, struct opt_struct *opts, struct id_set *visited)
+{
+	struct file_list_con *flc;
+
+	flc = fl_alloc(statbuf, opts);
+	flc->visited = visited;
+	flc->drp = drp_prep();
+
+	/* a depth-first traversal starts by going into the first directory */
+	if(opts->canonical || opts->depth_first)
+	{
+		flc->deep = true;
+		flc->sorted = opts->canonical;
+
+		/* which of several paths reaches a directory first must not depend on the threads */
+		flc->ordered = opts->canonical && (opts->threads > 1) && (visited == NULL);
+		flc->descend = dr_root(flc->drp, root, statbuf);
+		return flc;
+	}
+
+	/* create first directory record */
+	flc->l_dir = flc->c_dir = dr_root(flc->drp, root, statbuf);
+	pg_count(PG_TAKEN, 1);
+
+	/* open directory */
+	if((flc->dp = dir_open(fl_dpath(flc))) == NULL)
+	{
+		perror((root != NULL) ? root : ".");
+		fl_close(flc);
+		return NULL;
+	}
+
+	return flc;
+}
+
+/* prepare file list of a traversal worker */
+struct file_list_con * fl_prep_pool(struct stat *statbuf, struct opt_struct *opts, struct id_set *visited, struct work_pool *pool, unsigned int id, struct dr_pool *drp)
+{
+	struct file_list_con *flc;
+
+	flc = fl_alloc(statbuf, opts);
+	flc->visited = visited;
+	flc->drp = drp;
+
+	/* directories come from the work pool */
+	flc->pool = pool;
+	flc->id = id;
+
+	return flc;
+}
+
+/* open next directory */
+bool fl_dir(struct file_list_con *flc)
+{
+	char *path;
+	struct stat st;
+
+	while(true)
+	{
+		/* take the next directory from the work pool */
+		if(flc->pool != NULL)
+		{
+			if(flc->c_dir != NULL)
+			{
+				dr_release(flc->drp, flc->c_dir);
+				wp_finish(flc->pool);
+			}
+
+			flc->c_dir = wp_get(flc->pool, flc->id);
+		}
+
+		/* or from the linked list */
+		else if(flc->c_dir != NULL) flc->c_dir = dr_next(flc->drp, flc->c_dir);
+
+		/* if no more directories, return false */
+		if(flc->c_dir == NULL) return false;
+		pg_count(PG_TAKEN, 1);
+
+		/* the full path is walked once per directory, its files are
+		 * looked up relative to the open directory */
+		path = fl_dpath(flc);
+		if((flc->dp = dir_open(path)) == NULL)
+		{if(flc->verbose) perror((path != NULL) ? path : ".");}
+
+		/* examine a directory that was found by its directory entry type */
+		else if((!flc->c_dir->known) && (fstat(dirfd(flc->dp), &st) == -1))
+		{
+			if(flc->verbose) perror(path);
+			closedir(flc->dp);
+			flc->dp = NULL;
+		}
+
+		else if((!flc->c_dir->known) && (!dr_check(flc, flc->c_dir, st.st_ino, st.st_dev, path)))
+		{
+			closedir(flc->dp);
+			flc->dp = NULL;
+		}
+
+		else return true;
+	}
+}
+
+#ifdef DT_UNKNOWN
+/* file mode bits of a directory entry type, 0 if unknown */
+mode_t dtype_mode(unsigned char d_type)
+{
+	switch(d_type)
+	{
+		case DT_REG: return S_IFREG;
+		case DT_DIR: return S_IFDIR;
+		case DT_CHR: return S_IFCHR;
+		case DT_BLK: return S_IFBLK;
+		case DT_LNK: return S_IFLNK;
+		case DT_FIFO: return S_IFIFO;
+		case DT_SOCK: return S_IFSOCK;
+		default: return 0;
+	}
+}
+
+/* use the directory entry type instead of the file status if possible */
+bool fl_quick(struct file_list_con *flc, unsigned char d_type)
+{
+	mode_t mode;
+
+	/* the type must be known and must not lead somewhere else */
+	if((mode = dtype_mode(d_type)) == 0) return false;
+	if(S_ISLNK(mode) && flc->follow_link) return false;
+
+	/* only the type is filled in */
+	flc->statbuf->st_mode = mode;
+
+	/* files that are output may need more metadata */
+	if((flc->fields & (SF_SIZE | SF_MTIME | SF_NLINK)) && (file_type(flc->statbuf, flc->opts) != NULL))
+		return false;
+
+	flc->have_stat = false;
+
+	return true;
+}
+#endif
+
+#ifdef USE_IO_URING
+/* read a batch of directory entries and get their status through io_uring,
+ * returns false at the end of the directory */
+bool fl_fill(struct file_list_con *flc)
+{
+	size_t len, used, data, waiting;
+	int flags, res;
+	unsigned int mask;
+	struct dirent *dir_e;
+	struct batch_ent *be;
+	struct ent_batch *batch = &flc->batch;
+
+	batch->count = batch->pos = 0;
+	used = 0;
+
+	/* collect entries */
+	while((batch->count < BATCH_SIZE) && ((dir_e = readdir(flc->dp)) != NULL))
+	{
+		/* ignore the current and parent directories */
+		if((!strcmp(dir_e->d_name, ".")) || (!strcmp(dir_e->d_name, ".."))) continue;
+
+		/* copy the name, the directory stream reuses its buffer */
+		len = strlen(dir_e->d_name) + 1;
+		if(batch->space < used + len)
+			if((batch->names = realloc(batch->names, batch->space = (used + len) * 2)) == NULL)
+				failed("allocate batch names");
+		memcpy(batch->names + used, dir_e->d_name, len);
+
+		be = &batch->ents[batch->count++];
+		be->name = used;
+		used += len;
+
+		/* if the directory entry type is enough, skip the status call */
+		if((be->quick = fl_quick(flc, dir_e->d_type))) be->mode = flc->statbuf->st_mode;
+	}
+
+	if(batch->count == 0) return false;
+
+	/* queue status calls, the names no longer move */
+	flags = stx_flags(flc->follow_link, flc->fields);
+	mask = stx_mask(flc->fields);
+	waiting = 0;
+
+	for(data = 0; data < batch->count; data++)
+	{
+		be = &batch->ents[data];
+		if(be->quick) continue;
+
+		ring_statx(flc->ring, dirfd(flc->dp), batch->names + be->name, flags, mask, &be->stx, data);
+		waiting++;
+	}
+
+	/* submit them all at once and collect the results */
+	if(waiting && (ring_enter(flc->ring, waiting, waiting) == -1)) failed("submit status requests");
+
+	while(waiting)
+	{
+		if(!ring_reap(flc->ring, &data, &res))
+		{
+			if(ring_enter(flc->ring, 0, waiting) == -1) failed("wait for status requests");
+			continue;
+		}
+
+		batch->ents[data].res = res;
+		waiting--;
+	}
+
+	return true;
+}
+
+/* next file in list from io_uring status batches */
+char * fl_next_batch(struct file_list_con *flc)
+{
+	struct batch_ent *be;
+
+	/* loop until a good file is found */
+	while(true)
+	{
+		/* if no directory is open, open the next one */
+		if(flc->dp == NULL)
+			if(!fl_dir(flc)) return NULL;
+
+		/* if the batch is used up, read the next one */
+		if(flc->batch.pos == flc->batch.count)
+			if(!fl_fill(flc))
+			{
+				/* the end of the directory has been reached, close it */
+				closedir(flc->dp);
+				flc->dp = NULL;
+				continue;
+			}
+
+		be = &flc->batch.ents[flc->batch.pos++];
+		flc->name = flc->batch.names + be->name;
+
+		if(be->quick)
+		{
+			flc->statbuf->st_mode = be->mode;
+			flc->have_stat = false;
+			break;
+		}
+
+		if(be->res < 0)
+		{
+			errno = -be->res;
+			if(flc->verbose) perror(fl_path(flc));
+			errno = 0;
+			continue;
+		}
+
+		stx_conv(&be->stx, flc->statbuf);
+		flc->have_stat = true;
+		break;
+	}
+
+	/* if directory, add to list of directories to process */
+	if(S_ISDIR(flc->statbuf->st_mode)) dr_add(flc);
+
+	return flc->name;
+}
+#endif
+
+/* compare directory entries by name */
+int ent_cmp(const void *a, const void *b)
+{
+	return strcmp(((struct sort_ent *)a)->name, ((struct sort_ent *)b)->name);
+}
+
+/* close the open directory furthest up in a depth-first traversal */
+void fl_shut(struct file_list_con *flc)
+{
+	struct dir_level *lv;
+
+	lv = &flc->levels[flc->closed++];
+	if(!flc->sorted) lv->loc = telldir(lv->dp);
+	closedir(lv->dp);
+	lv->dp = NULL;
+}
+
+/* open the current directory of a depth-first traversal again after it was closed,
+ * returns false if it can't be read any more */
+bool fl_reopen(struct file_list_con *flc)
+{
+	char *path;
+	struct stat st;
+	struct dir_level *lv;
+
+	lv = &flc->levels[flc->depth - 1];
+	path = lv->pre_len ? flc->d_path : NULL;
+
+	if((lv->dp = dir_open(path)) == NULL)
+	{
+		if(flc->verbose) perror((path != NULL) ? path : ".");
+		return false;
+	}
+
+	/* the path must still lead to the same directory */
+	if((fstat(dirfd(lv->dp), &st) == -1) || (st.st_ino != lv->dr->ino) || (st.st_dev != lv->dr->dev))
+	{
+		if(flc->verbose) fprintf(stderr, "%s: directory replaced during traversal\n", (path != NULL) ? path : ".");
+		closedir(lv->dp);
+		lv->dp = NULL;
+		return false;
+	}
+
+	if(!flc->sorted) seekdir(lv->dp, lv->loc);
+	flc->closed--;
+
+	return true;
+}
+
+/* go into a directory of a depth-first traversal, returns false if it is skipped */
+bool fl_push(struct file_list_con *flc, struct dir_rec *dr)
+{
+	int fd, pfd;
+	size_t i, len, used, pre_len;
+	char *name, *path;
+	DIR *dp;
+	struct stat st;
+	struct dirent *dir_e;
+	struct dir_level *lv;
+
+	pg_count(PG_TAKEN, 1);
+
+	/* grow the level stack */
+	if(flc->depth == flc->l_space)
+	{
+		if((flc->levels = realloc(flc->levels, (flc->l_space + 16) * sizeof(struct dir_level))) == NULL)
+			failed("allocate directory levels");
+		for(i = flc->l_space; i < flc->l_space + 16; i++)
+		{
+			flc->levels[i].ents = NULL;
+			flc->levels[i].names = NULL;
+			flc->levels[i].e_space = flc->levels[i].n_space = 0;
+		}
+		flc->l_space += 16;
+	}
+
+	pre_len = flc->pre_len;
+
+	/* the first directory is opened by its path */
+	if(flc->depth == 0)
+	{
+		flc->c_dir = dr;
+		path = fl_dpath(flc);
+		name = (path != NULL) ? path : ".";
+		pfd = AT_FDCWD;
+	}
+
+	/* its subdirectories are opened relative to their parents */
+	else
+	{
+		/* make room by closing the directory furthest up */
+		if(flc->depth - flc->closed >= flc->open_max) fl_shut(flc);
+
+		/* extend the directory path */
+		len = flc->pre_len ? flc->pre_len + 1 + dr->len : dr->len;
+		if(flc->d_space < len + 1)
+			if((flc->d_path = realloc(flc->d_path, flc->d_space = len + 1)) == NULL)
+				failed("allocate directory path");
+		if(flc->pre_len) flc->d_path[flc->pre_len] = '/';
+		memcpy(flc->d_path + len - dr->len, dr->name, dr->len + 1);
+		flc->pre_len = len;
+		path = flc->d_path;
+
+		/* or by their paths if the parent was closed */
+		if(flc->closed == flc->depth)
+		{
+			name = path;
+			pfd = AT_FDCWD;
+		}
+		else
+		{
+			name = dr->name;
+			pfd = dirfd(flc->levels[flc->depth - 1].dp);
+		}
+	}
+
+	dp = NULL;
+	if(((fd = openat(pfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1) || ((dp = fdopendir(fd)) == NULL))
+	{
+		if(flc->verbose) perror((path != NULL) ? path : ".");
+		if((fd != -1) && (dp == NULL)) close(fd);
+		dp = NULL;
+	}
+
+	/* examine a directory that was found by its directory entry type */
+	else if((!dr->known) && ((fstat(fd, &st) == -1) || (!dr_check(flc, dr, st.st_ino, st.st_dev, path))))
+	{
+		closedir(dp);
+		dp = NULL;
+	}
+
+	if(dp == NULL)
+	{
+		flc->pre_len = pre_len;
+		if(flc->d_path != NULL) flc->d_path[pre_len] = '\0';
+		if(flc->depth == 0) flc->c_dir = NULL;
+		dr_release(flc->drp, dr);
+		return false;
+	}
+
+	lv = &flc->levels[flc->depth];
+	lv->dr = dr;
+	lv->dp = dp;
+	lv->pre_len = flc->pre_len;
+	flc->c_dir = dr;
+	flc->depth++;
+
+	/* in directory order, entries are read as the traversal goes */
+	if(!flc->sorted) return true;
+
+	lv->count = lv->pos = 0;
+	used = 0;
+
+	/* read the whole directory */
+	while((dir_e = readdir(dp)) != NULL)
+	{
+		/* ignore the current and parent directories */
+		if((!strcmp(dir_e->d_name, ".")) || (!strcmp(dir_e->d_name, ".."))) continue;
+
+		len = strlen(dir_e->d_name) + 1;
+		if(lv->n_space < used + len)
+			if((lv->names = realloc(lv->names, lv->n_space = (used + len) * 2)) == NULL)
+				failed("allocate directory entry names");
+		memcpy(lv->names + used, dir_e->d_name, len);
+
+		if(lv->count == lv->e_space)
+			if((lv->ents = realloc(lv->ents, (lv->e_space = lv->e_space * 2 + 64) * sizeof(struct sort_ent))) == NULL)
+				failed("allocate directory entries");
+
+		lv->ents[lv->count].off = used;
+#ifdef DT_UNKNOWN
+		lv->ents[lv->count].type = dir_e->d_type;
+#else
+		lv->ents[lv->count].type = 0;
+#endif
+		lv->count++;
+		used += len;
+	}
+
+	/* sort by name once the names no longer move */
+	for(i = 0; i < lv->count; i++) lv->ents[i].name = lv->names + lv->ents[i].off;
+	if(lv->count > 1) qsort(lv->ents, lv->count, sizeof(struct sort_ent), ent_cmp);
+
+	return true;
+}
+
+/* next file of a sorted depth-first traversal */
+char * fl_next_sorted(struct file_list_con *flc)
+{
+	struct dir_level *lv;
+	struct sort_ent *ent;
+
+	/* loop until a good file is found */
+	while(true)
+	{
+		/* go into the directory found last time */
+		if(flc->descend != NULL)
+		{
+			fl_push(flc, flc->descend);
+			flc->descend = NULL;
+		}
+
+		if(flc->depth == 0) return NULL;
+
+		/* if the end of the directory has been reached, go back up */
+		lv = &flc->levels[flc->depth - 1];
+		if(lv->pos == lv->count)
+		{
+			fl_pop(flc);
+			continue;
+		}
+
+		/* status calls are relative to the directory, which may have been closed */
+		if((flc->closed == flc->depth) && (!fl_reopen(flc)))
+		{
+			fl_pop(flc);
+			continue;
+		}
+
+		ent = &lv->ents[lv->pos++];
+		flc->name = ent->name;
+
+#ifdef DT_UNKNOWN
+		/* if the directory entry type is enough, skip the status call */
+		if(fl_quick(flc, ent->type)) break;
+#endif
+
+		flc->have_stat = true;
+
+		/* get status relative to the open directory */
+		if(get_stat(flc->follow_link, dirfd(lv->dp), flc->name, flc->statbuf, flc->fields, false))
+		{
+			if(flc->verbose) perror(fl_path(flc));
+			continue;
+		}
+		else break;
+	}
+
+	/* if directory, go into it after this file */
+	if(S_ISDIR(flc->statbuf->st_mode)) flc->descend = dr_new(flc);
+
+	return flc->name;
+}
+
+/* next file of a depth-first traversal in directory order */
+char * fl_next_deep(struct file_list_con *flc)
+{
+	struct dir_level *lv;
+	struct dirent *dir_e;
+
+	/* loop until a good file is found */
+	while(true)
+	{
+		/* go into the directory found last time */
+		if(flc->descend != NULL)
+		{
+			fl_push(flc, flc->descend);
+			flc->descend = NULL;
+		}
+
+		if(flc->depth == 0) return NULL;
+
+		/* go on where reading stopped if the directory was closed */
+		if((flc->closed == flc->depth) && (!fl_reopen(flc)))
+		{
+			fl_pop(flc);
+			continue;
+		}
+
+		/* if the end of the directory has been reached, go back up */
+		lv = &flc->levels[flc->depth - 1];
+		if((dir_e = readdir(lv->dp)) == NULL)
+		{
+			fl_pop(flc);
+			continue;
+		}
+
+		/* ignore the current and parent directories */
+		if((!strcmp(dir_e->d_name, ".")) || (!strcmp(dir_e->d_name, ".."))) continue;
+
+		flc->name = dir_e->d_name;
+
+#ifdef DT_UNKNOWN
+		/* if the directory entry type is enough, skip the status call */
+		if(fl_quick(flc, dir_e->d_type)) break;
+#endif
+
+		flc->have_stat = true;
+
+		/* get status relative to the open directory */
+		if(get_stat(flc->follow_link, dirfd(lv->dp), flc->name, flc->statbuf, flc->fields, false))
+		{
+			if(flc->verbose) perror(fl_path(flc));
+			continue;
+		}
+		else break;
+	}
+
+	/* if directory, go into it after this file */
+	if(S_ISDIR(flc->statbuf->st_mode)) flc->descend = dr_new(flc);
+
+	return flc->name;
+}
+
+/* compare files of a directory being read by name */
+int ord_cmp(const void *a, const void *b)
+{
+	return strcmp(((struct ord_ent *)a)->name, ((struct ord_ent *)b)->name);
+}
+
+/* new directory of an ordered parallel traversal */
+struct ord_dir * ord_new(struct dir_rec *dr)
+{
+	struct ord_dir *od;
+
+	if((od = malloc(sizeof(struct ord_dir))) == NULL) failed("allocate directory");
+	od->dr = dr;
+	od->ents = NULL;
+	od->count = od->size = 0;
+	od->ready = od->spilled = false;
+	od->next = NULL;
+
+	return od;
+}
+
+/* read a whole directory of an ordered parallel traversal, sorted by name */
+void ord_read(struct ord_worker *w, struct ord_dir *od)
+{
+	size_t i, n, len, used, count, size;
+	off_t off = 0;
+	bool quick, spill;
+	char *path, *names;
+	DIR *dp;
+	struct stat st;
+	struct dirent *dir_e;
+	struct dir_rec *dr;
+	struct ord_ent *ent, *block;
+	struct ord_dir *child;
+	struct ord_trav *ot = w->ot;
+	struct file_list_con *flc = w->flc;
+
+	pg_count(PG_TAKEN, 1);
+
+	flc->c_dir = od->dr;
+	path = fl_dpath(flc);
+	count = used = 0;
+
+	if((dp = dir_open(path)) == NULL)
+	{if(flc->verbose) perror((path != NULL) ? path : ".");}
+
+	/* examine a directory that was found by its directory entry type */
+	else if((!od->dr->known) && ((fstat(dirfd(dp), &st) == -1) || (!dr_check(flc, od->dr, st.st_ino, st.st_dev, path))))
+	{
+		if(flc->verbose && (!od->dr->known)) perror(path);
+		closedir(dp);
+		dp = NULL;
+	}
+
+	while((dp != NULL) && ((dir_e = readdir(dp)) != NULL))
+	{
+		/* ignore the current and parent directories */
+		if((!strcmp(dir_e->d_name, ".")) || (!strcmp(dir_e->d_name, ".."))) continue;
+
+		flc->name = dir_e->d_name;
+		quick = false;
+
+#ifdef DT_UNKNOWN
+		/* if the directory entry type is enough, skip the status call */
+		quick = fl_quick(flc, dir_e->d_type);
+#endif
+
+		if(!quick)
+		{
+			flc->have_stat = true;
+
+			/* get status relative to the open directory */
+			if(get_stat(flc->follow_link, dirfd(dp), flc->name, flc->statbuf, flc->fields, false))
+			{
+				if(flc->verbose) perror(fl_path(flc));
+				continue;
+			}
+		}
+
+		/* only files that are output and directories that are gone into are kept */
+		child = NULL;
+		if(S_ISDIR(flc->statbuf->st_mode) && ((dr = dr_new(flc)) != NULL)) child = ord_new(dr);
+		if((child == NULL) && (file_type(flc->statbuf, flc->opts) == NULL)) continue;
+
+		len = strlen(flc->name) + 1;
+		if(w->n_space < used + len)
+			if((w->names = realloc(w->names, w->n_space = (used + len) * 2)) == NULL)
+				failed("allocate directory entry names");
+		memcpy(w->names + used, flc->name, len);
+
+		if(count == w->e_space)
+			if((w->ents = realloc(w->ents, (w->e_space = w->e_space * 2 + 64) * sizeof(struct ord_ent))) == NULL)
+				failed("allocate directory entries");
+
+		ent = &w->ents[count++];
+		ent->statbuf = *flc->statbuf;
+		ent->off = used;
+		ent->child = child;
+		used += len;
+	}
+
+	if(dp != NULL) closedir(dp);
+	flc->c_dir = NULL;
+
+	/* sort by name once the names no longer move */
+	for(i = 0; i < count; i++) w->ents[i].name = w->names + w->ents[i].off;
+	if(count > 1) qsort(w->ents, count, sizeof(struct ord_ent), ord_cmp);
+
+	/* the files and their names go in one block */
+	block = NULL;
+	size = 0;
+	if(count)
+	{
+		size = count * sizeof(struct ord_ent) + used;
+		if((block = malloc(size)) == NULL) failed("allocate directory entries");
+		memcpy(block, w->ents, count * sizeof(struct ord_ent));
+		names = (char *)(block + count);
+		memcpy(names, w->names, used);
+		for(i = 0; i < count; i++) block[i].name = names + block[i].off;
+	}
+
+	pthread_mutex_lock(&ot->lock);
+
+	/* the first subdirectory ends up on top */
+	for(i = count, n = 0; i-- > 0;)
+		if((child = block[i].child) != NULL)
+		{
+			child->next = ot->stack;
+			ot->stack = child;
+			n++;
+		}
+	ot->pending += n;
+	if(n) pthread_cond_broadcast(&ot->more);
+
+	/* past the memory bound, the files wait in the temporary file */
+	if((spill = (ot->held + size > ORD_HELD)))
+	{
+		if(ot->spill == NULL)
+			if((ot->spill = tmpfile()) == NULL) failed("create temporary file");
+		off = ot->spill_end;
+		ot->spill_end += size;
+	}
+	else ot->held += size;
+
+	pthread_mutex_unlock(&ot->lock);
+
+	if(spill)
+	{
+		if(pwrite(fileno(ot->spill), block, size, off) != (ssize_t)size) failed("write directory entries to the temporary file");
+		free(block);
+		block = NULL;
+	}
+
+	pthread_mutex_lock(&ot->lock);
+
+	od->ents = block;
+	od->count = count;
+	od->size = size;
+	od->spilled = spill;
+	od->off = off;
+	od->ready = true;
+
+	/* the traversal is over once no directory is waiting or being read */
+	if(--ot->pending == 0) pthread_cond_broadcast(&ot->more);
+	pthread_cond_broadcast(&ot->ready);
+
+	pthread_mutex_unlock(&ot->lock);
+}
+
+/* traversal thread of an ordered parallel traversal */
+void * ord_main(void *arg)
+{
+	struct ord_worker *w = arg;
+	struct ord_trav *ot = w->ot;
+	struct ord_dir *od;
+
+	pthread_mutex_lock(&ot->lock);
+
+	while(true)
+	{
+		while((ot->stack == NULL) && ot->pending && (!ot->done)) pthread_cond_wait(&ot->more, &ot->lock);
+		if(ot->done || (ot->stack == NULL)) break;
+
+		od = ot->stack;
+		ot->stack = od->next;
+
+		pthread_mutex_unlock(&ot->lock);
+		ord_read(w, od);
+		pthread_mutex_lock(&ot->lock);
+	}
+
+	pthread_mutex_unlock(&ot->lock);
+
+	return NULL;
+}
+
+/* start the threads of an ordered parallel traversal on its first directory */
+void ord_start(struct file_list_con *flc)
+{
+	unsigned int i;
+	struct ord_trav *ot;
+	struct ord_worker *w;
+
+	if((ot = calloc(1, sizeof(struct ord_trav))) == NULL) failed("allocate ordered traversal");
+	if(pthread_mutex_init(&ot->lock, NULL)) failed("initialize traversal lock");
+	if(pthread_cond_init(&ot->more, NULL) || pthread_cond_init(&ot->ready, NULL))
+		failed("initialize traversal condition");
+
+	ot->descend = ot->stack = ord_new(flc->descend);
+	ot->pending = 1;
+	flc->descend = NULL;
+	flc->ord = ot;
+
+	ot->count = flc->opts->threads;
+	if((ot->workers = calloc(ot->count, sizeof(struct ord_worker))) == NULL)
+		failed("allocate traversal workers");
+
+	for(i = 0; i < ot->count; i++)
+	{
+		w = &ot->workers[i];
+		w->ot = ot;
+		w->flc = fl_alloc(&w->statbuf, flc->opts);
+		w->flc->drp = flc->drp;
+		if(pthread_create(&w->thread, NULL, ord_main, w)) failed("create traversal thread");
+	}
+}
+
+/* go into a directory of an ordered parallel traversal once it has been read */
+void ord_enter(struct file_list_con *flc, struct ord_dir *od)
+{
+	size_t len;
+	struct ord_trav *ot = flc->ord;
+	struct ord_level *lv;
+
+	pthread_mutex_lock(&ot->lock);
+	while(!od->ready) pthread_cond_wait(&ot->ready, &ot->lock);
+	pthread_mutex_unlock(&ot->lock);
+
+	ord_load(ot, od);
+
+	/* the first directory has its whole path */
+	if(ot->depth == 0)
+	{
+		flc->c_dir = od->dr;
+		fl_dpath(flc);
+		flc->c_dir = NULL;
+	}
+
+	/* extend the directory path */
+	else
+	{
+		len = flc->pre_len ? flc->pre_len + 1 + od->dr->len : od->dr->len;
+		if(flc->d_space < len + 1)
+			if((flc->d_path = realloc(flc->d_path, flc->d_space = len + 1)) == NULL)
+				failed("allocate directory path");
+		if(flc->pre_len) flc->d_path[flc->pre_len] = '/';
+		memcpy(flc->d_path + len - od->dr->len, od->dr->name, od->dr->len + 1);
+		flc->pre_len = len;
+	}
+
+	if(ot->depth == ot->l_space)
+		if((ot->levels = realloc(ot->levels, (ot->l_space += 16) * sizeof(struct ord_level))) == NULL)
+			failed("allocate directory levels");
+
+	lv = &ot->levels[ot->depth++];
+	lv->od = od;
+	lv->pos = 0;
+	lv->pre_len = flc->pre_len;
+}
+
+/* leave the current directory of an ordered parallel traversal */
+void ord_leave(struct file_list_con *flc)
+{
+	struct ord_trav *ot = flc->ord;
+	struct ord_dir *od;
+
+	od = ot->levels[--ot->depth].od;
+
+	/* its room can be taken by directories read ahead */
+	if(!od->spilled)
+	{
+		pthread_mutex_lock(&ot->lock);
+		ot->held -= od->size;
+		pthread_mutex_unlock(&ot->lock);
+	}
+
+	free(od->ents);
+	dr_release(flc->drp, od->dr);
+	free(od);
+
+	if(ot->depth)
+	{
+		flc->pre_len = ot->levels[ot->depth - 1].pre_len;
+		flc->d_path[flc->pre_len] = '\0';
+	}
+}
+
+/* next file of an ordered parallel traversal */
+char * fl_next_ord(struct file_list_con *flc)
+{
+	struct ord_trav *ot;
+	struct ord_level *lv;
+	struct ord_ent *ent;
+
+	if(flc->ord == NULL)
+	{
+		if(flc->descend == NULL) return NULL;
+		ord_start(flc);
+	}
+
+	ot = flc->ord;
+
+	while(true)
+	{
+		/* go into the directory found last time */
+		if(ot->descend != NULL)
+		{
+			ord_enter(flc, ot->descend);
+			ot->descend = NULL;
+		}
+
+		/* the end of the traversal */
+		if(ot->depth == 0)
+		{
+			ord_close(flc);
+			return NULL;
+		}
+
+		/* if the end of the directory has been reached, go back up */
+		lv = &ot->levels[ot->depth - 1];
+		if(lv->pos == lv->od->count)
+		{
+			ord_leave(flc);
+			continue;
+		}
+
+		ent = &lv->od->ents[lv->pos++];
+		flc->name = ent->name;
+		*flc->statbuf = ent->statbuf;
+		ot->descend = ent->child;
+
+		return flc->name;
+	}
+}
+
+/* next file in list by the order of the traversal */
+char * fl_entry(struct file_list_con *flc)
+{
+	struct dirent *dir_e;
+
+	if(flc->ordered) return fl_next_ord(flc);
+	if(flc->deep) return flc->sorted ? fl_next_sorted(flc) : fl_next_deep(flc);
+
+#ifdef USE_IO_URING
+	if(flc->ring != NULL) return fl_next_batch(flc);
+#endif
+
+	/* loop until a good file is found */
+	while(true)
+	{
+		/* if no directory is open, open the next one */
+		if(flc->dp == NULL)
+			if(!fl_dir(flc)) return NULL;
+
+		/* get the next file in the directory */
+		if((dir_e = readdir(flc->dp)) != NULL)
+		{
+			/* ignore the current and parent directories */
+			if((!strcmp(dir_e->d_name, ".")) || (!strcmp(dir_e->d_name, ".."))) continue;
+
+			flc->name = dir_e->d_name;
+
+#ifdef DT_UNKNOWN
+			/* if the directory entry type is enough, skip the status call */
+			if(fl_quick(flc, dir_e->d_type)) break;
+#endif
+
+			flc->have_stat = true;
+
+			/* get status relative to the open directory */
+			if(get_stat(flc->follow_link, dirfd(flc->dp), flc->name, flc->statbuf, flc->fields, false))
+			{
+				if(flc->verbose) perror(fl_path(flc));
+				continue;
+			}
+			else break;
+		}
+
+		/* if the end of the directory has been reached, close it */
+		else
+		{
+			closedir(flc->dp);
+			flc->dp = NULL;
+		}
+	}
+
+	/* if directory, add to list of directories to process */
+	if(S_ISDIR(flc->statbuf->st_mode)) dr_add(flc);
+
+	return flc->name;
+}
+
+/* next file in list, returns the file name within its directory */
+char * fl_next(struct file_list_con *flc)
+{
+	uint64_t start;
+	char *name;
+
+	start = st_begin();
+	if((name = fl_entry(flc)) != NULL)
+	{
+		st_end(ST_NEXT, start, false, 0);
+		pg_count(PG_FILES, 1);
+	}
+
+	return name;
+}
+
+/* XXH3 default secret */
+const unsigned char xh_secret[XXH_SECRET] = {
+	0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+	0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+	0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+	0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+	0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+	0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+	0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+	0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+	0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+	0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+	0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+	0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e};
+
+/* read a little-endian 32-bit number */
+uint32_t get_le32(const unsigned char *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* read a little-endian 64-bit number */
+uint64_t get_le64(const unsigned char *p)
+{
+	return (uint64_t)get_le32(p) | ((uint64_t)get_le32(p + 4) << 32);
+}
+
+/* rotate left */
+uint64_t rotl64(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+/* reverse the byte order */
+uint64_t swap64(uint64_t x)
+{
+	x = ((x & 0x00FF00FF00FF00FFULL) << 8) | ((x >> 8) & 0x00FF00FF00FF00FFULL);
+	x = ((x & 0x0000FFFF0000FFFFULL) << 16) | ((x >> 16) & 0x0000FFFF0000FFFFULL);
+	return (x << 32) | (x >> 32);
+}
+
+/* multiply to 128 bits and fold the halves together */
+uint64_t xh_mul_fold(uint64_t a, uint64_t b)
+{
+#ifdef __SIZEOF_INT128__
+	unsigned __int128 p = (unsigned __int128)a * b;
+
+	return (uint64_t)p ^ (uint64_t)(p >> 64);
+#else
+	uint64_t lo_lo, hi_lo, lo_hi, hi_hi, cross, upper, lower;
+
+	lo_lo = (a & 0xFFFFFFFF) * (b & 0xFFFFFFFF);
+	hi_lo = (a >> 32) * (b & 0xFFFFFFFF);
+	lo_hi = (a & 0xFFFFFFFF) * (b >> 32);
+	hi_hi = (a >> 32) * (b >> 32);
+
+	cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFF) + lo_hi;
+	upper = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+	lower = (cross << 32) | (lo_lo & 0xFFFFFFFF);
+
+	return lower ^ upper;
+#endif
+}
+
+/* final mixing steps */
+uint64_t xh64_avalanche(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= XXH_PRIME64_2;
+	h ^= h >> 29;
+	h *= XXH_PRIME64_3;
+	return h ^ (h >> 32);
+}
+
+uint64_t xh_avalanche(uint64_t h)
+{
+	h ^= h >> 37;
+	h *= 0x165667919E3779F9ULL;
+	return h ^ (h >> 32);
+}
+
+uint64_t xh_rrmxmx(uint64_t h, uint64_t len)
+{
+	h ^= rotl64(h, 49) ^ rotl64(h, 24);
+	h *= 0x9FB21C651E98DF25ULL;
+	h ^= (h >> 35) + len;
+	h *= 0x9FB21C651E98DF25ULL;
+	return h ^ (h >> 28);
+}
+
+/* mix 16 bytes of input */
+uint64_t xh_mix16(const unsigned char *in, const unsigned char *secret)
+{
+	return xh_mul_fold(get_le64(in) ^ get_le64(secret), get_le64(in + 8) ^ get_le64(secret + 8));
+}
+
+/* hash at most 240 bytes */
+uint64_t xh_short(const unsigned char *in, size_t len)
+{
+	const unsigned char *s = xh_secret;
+	uint64_t acc, lo, hi;
+	uint32_t c;
+	size_t i;
+
+	if(len == 0) return xh64_avalanche(get_le64(s + 56) ^ get_le64(s + 64));
+
+	if(len <= 3)
+	{
+		c = ((uint32_t)in[0] << 16) | ((uint32_t)in[len >> 1] << 24) | in[len - 1] | ((uint32_t)len << 8);
+		return xh64_avalanche(c ^ (uint64_t)(get_le32(s) ^ get_le32(s + 4)));
+	}
+
+	if(len <= 8)
+	{
+		acc = get_le32(in + len - 4) + ((uint64_t)get_le32(in) << 32);
+		return xh_rrmxmx(acc ^ (get_le64(s + 8) ^ get_le64(s + 16)), len);
+	}
+
+	if(len <= 16)
+	{
+		lo = get_le64(in) ^ (get_le64(s + 24) ^ get_le64(s + 32));
+		hi = get_le64(in + len - 8) ^ (get_le64(s + 40) ^ get_le64(s + 48));
+		return xh_avalanche(len + swap64(lo) + hi + xh_mul_fold(lo, hi));
+	}
+
+	acc = len * XXH_PRIME64_1;
+
+	if(len <= 128)
+	{
+		/* pairs of 16-byte blocks from both ends */
+		for(i = (len - 1) / 32; ; i--)
+		{
+			acc += xh_mix16(in + 16 * i, s + 32 * i);
+			acc += xh_mix16(in + len - 16 * (i + 1), s + 32 * i + 16);
+			if(i == 0) break;
+		}
+
+		return xh_avalanche(acc);
+	}
+
+	for(i = 0; i < 8; i++) acc += xh_mix16(in + 16 * i, s + 16 * i);
+	acc = xh_avalanche(acc);
+
+	for(i = 8; i < len / 16; i++) acc += xh_mix16(in + 16 * i, s + 16 * (i - 8) + 3);
+	acc += xh_mix16(in + len - 16, s + XXH_SECRET_MIN - 17);
+
+	return xh_avalanche(acc);
+}
+
+/* accumulate one 64-byte stripe */
+#if defined(__AVX2__)
+void xh_stripe(uint64_t *acc, const unsigned char *in, const unsigned char *secret)
+{
+	__m256i data, key, prod, sum;
+	int i;
+
+	for(i = 0; i < 2; i++)
+	{
+		data = _mm256_loadu_si256((const __m256i *)(in + 32 * i));
+		key = _mm256_xor_si256(data, _mm256_loadu_si256((const __m256i *)(secret + 32 * i)));
+
+		/* product of the low and high halves of each key lane */
+		prod = _mm256_mul_epu32(key, _mm256_shuffle_epi32(key, _MM_SHUFFLE(0, 3, 0, 1)));
+
+		/* the data is added to the neighbouring lane */
+		sum = _mm256_add_epi64(_mm256_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2)), prod);
+		_mm256_storeu_si256((__m256i *)(acc + 4 * i),
+			_mm256_add_epi64(_mm256_loadu_si256((const __m256i *)(acc + 4 * i)), sum));
+	}
+}
+#elif defined(__SSE2__)
+void xh_stripe(uint64_t *acc, const unsigned char *in, const unsigned char *secret)
+{
+	__m128i data, key, prod, sum;
+	int i;
+
+	for(i = 0; i < 4; i++)
+	{
+		data = _mm_loadu_si128((const __m128i *)(in + 16 * i));
+		key = _mm_xor_si128(data, _mm_loadu_si128((const __m128i *)(secret + 16 * i)));
+
+		/* product of the low and high halves of each key lane */
+		prod = _mm_mul_epu32(key, _mm_shuffle_epi32(key, _MM_SHUFFLE(0, 3, 0, 1)));
+
+		/* the data is added to the neighbouring lane */
+		sum = _mm_add_epi64(_mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2)), prod);
+		_mm_storeu_si128((__m128i *)(acc + 2 * i),
+			_mm_add_epi64(_mm_loadu_si128((const __m128i *)(acc + 2 * i)), sum));
+	}
+}
+#else
+void xh_stripe(uint64_t *acc, const unsigned char *in, const unsigned char *secret)
+{
+	uint64_t data, key;
+	int i;
+
+	for(i = 0; i < 8; i++)
+	{
+		data = get_le64(in + 8 * i);
+		key = data ^ get_le64(secret + 8 * i);
+		acc[i ^ 1] += data;
+		acc[i] += (key & 0xFFFFFFFF) * (key >> 32);
+	}
+}
+#endif
+
+/* scramble the accumulators at the end of a block */
+void xh_scramble(uint64_t *acc)
+{
+	const unsigned char *s = xh_secret + XXH_SECRET - 64;
+	int i;
+
+	for(i = 0; i < 8; i++)
+		acc[i] = (acc[i] ^ (acc[i] >> 47) ^ get_le64(s + 8 * i)) * XXH_PRIME32_1;
+}
+
+/* accumulate stripes, a block ends every 16 stripes */
+void xh_stripes(struct xxh3 *st, const unsigned char *in, size_t count)
+{
+	size_t i;
+
+	for(i = 0; i < count; i++)
+	{
+		xh_stripe(st->acc, in + 64 * i, xh_secret + 8 * st->stripe);
+
+		if(++st->stripe == (XXH_SECRET - 64) / 8)
+		{
+			xh_scramble(st->acc);
+			st->stripe = 0;
+		}
+	}
+}
+
+/* start a hash */
+void xh_init(struct xxh3 *st)
+{
+	st->acc[0] = XXH_PRIME32_3;
+	st->acc[1] = XXH_PRIME64_1;
+	st->acc[2] = XXH_PRIME64_2;
+	st->acc[3] = XXH_PRIME64_3;
+	st->acc[4] = XXH_PRIME64_4;
+	st->acc[5] = XXH_PRIME32_2;
+	st->acc[6] = XXH_PRIME64_5;
+	st->acc[7] = XXH_PRIME32_1;
+	st->len = 0;
+	st->stripe = 0;
+	st->buf_len = 0;
+}
+
+/* hash more data
+ * a stripe is only accumulated once more data follows it, the last one is handled by xh_final() */
+void xh_update(struct xxh3 *st, const unsigned char *in, size_t len)
+{
+	size_t n;
+
+	st->len += len;
+
+	/* hold back data until the buffer is full */
+	if(st->buf_len + len <= XXH_BUF)
+	{
+		memcpy(st->buf + st->buf_len, in, len);
+		st->buf_len += len;
+		return;
+	}
+
+	/* complete and accumulate the buffer */
+	if(st->buf_len)
+	{
+		n = XXH_BUF - st->buf_len;
+		memcpy(st->buf + st->buf_len, in, n);
+		xh_stripes(st, st->buf, XXH_BUF / 64);
+		in += n;
+		len -= n;
+	}
+
+	/* accumulate directly from the input, keeping the last stripe for xh_final() */
+	if(len > XXH_BUF)
+	{
+		n = (len - 1) / 64;
+		xh_stripes(st, in, n);
+		in += n * 64;
+		len -= n * 64;
+		memcpy(st->buf + XXH_BUF - 64, in - 64, 64);
+	}
+
+	memcpy(st->buf, in, len);
+	st->buf_len = len;
+}
+
+/* accumulate a stripe of zeros, only the secret is left of it */
+void xh_zero_stripe(uint64_t *acc, unsigned int stripe)
+{
+	uint64_t key;
+	int i;
+
+	for(i = 0; i < 8; i++)
+	{
+		key = get_le64(xh_secret + 8 * stripe + 8 * i);
+		acc[i] += (key & 0xFFFFFFFF) * (key >> 32);
+	}
+}
+
+/* hash a run of zeros
+ * a block of zero stripes always adds the same to the accumulators, so they are not hashed one by one */
+void xh_zeros(struct xxh3 *st, uintmax_t len)
+{
+	unsigned char zero[XXH_BUF + 64];
+	uint64_t block[8];
+	uintmax_t n;
+	unsigned int per = (XXH_SECRET - 64) / 8, i;
+
+	memset(zero, 0, sizeof(zero));
+
+	/* short runs are hashed as they are */
+	if(len <= 4 * XXH_BUF)
+	{
+		for(; len; len -= n)
+		{
+			n = (len < sizeof(zero)) ? len : sizeof(zero);
+			xh_update(st, zero, n);
+		}
+		return;
+	}
+
+	/* afterwards only zeros are held back, and the last accumulated stripe is zeros too */
+	xh_update(st, zero, sizeof(zero));
+	len -= sizeof(zero);
+
+	/* accumulate all but the last stripe, like xh_update() does */
+	n = (st->buf_len + len - 1) / 64;
+	st->len += len;
+	st->buf_len = st->buf_len + len - 64 * n;
+	memset(st->buf, 0, XXH_BUF);
+
+	/* finish the current block */
+	for(; n && st->stripe; n--)
+	{
+		xh_zero_stripe(st->acc, st->stripe);
+
+		if(++st->stripe == per)
+		{
+			xh_scramble(st->acc);
+			st->stripe = 0;
+		}
+	}
+
+	/* whole blocks */
+	memset(block, 0, sizeof(block));
+	for(i = 0; i < per; i++) xh_zero_stripe(block, i);
+
+	for(; n >= per; n -= per)
+	{
+		for(i = 0; i < 8; i++) st->acc[i] += block[i];
+		xh_scramble(st->acc);
+	}
+
+	/* the start of the last block */
+	for(; n; n--) xh_zero_stripe(st->acc, st->stripe++);
+}
+
+/* finish a hash */
+uint64_t xh_final(struct xxh3 *st)
+{
+	unsigned char last[64];
+	uint64_t acc, *a;
+	size_t n;
+	int i;
+
+	if(st->len <= 240) return xh_short(st->buf, st->len);
+
+	/* accumulate the rest of the buffer, and the last stripe with its own secret */
+	if(st->buf_len >= 64)
+	{
+		n = (st->buf_len - 1) / 64;
+		xh_stripes(st, st->buf, n);
+		xh_stripe(st->acc, st->buf + st->buf_len - 64, xh_secret + XXH_SECRET - 64 - 7);
+	}
+	else
+	{
+		/* the last stripe begins in data that was already accumulated */
+		n = 64 - st->buf_len;
+		memcpy(last, st->buf + XXH_BUF - n, n);
+		memcpy(last + n, st->buf, st->buf_len);
+		xh_stripe(st->acc, last, xh_secret + XXH_SECRET - 64 - 7);
+	}
+
+	/* merge the accumulators */
+	a = st->acc;
+	acc = st->len * XXH_PRIME64_1;
+	for(i = 0; i < 4; i++)
+		acc += xh_mul_fold(a[2 * i] ^ get_le64(xh_secret + 11 + 16 * i), a[2 * i + 1] ^ get_le64(xh_secret + 19 + 16 * i));
+
+	return xh_avalanche(acc);
+}
+
+/* hash a whole string */
+uint64_t xh_hash(const void *in, size_t len)
+{
+	struct xxh3 st;
+
+	xh_init(&st);
+	xh_update(&st, in, len);
+
+	return xh_final(&st);
+}
+
+/* fill in the cache key of a file piece, piece size 0 is the whole file */
+void hc_key(struct hash_cache *hc, struct hc_slot *key, struct stat *statbuf, uint64_t piecesize, uint64_t piece)
+{
+	key->dev = statbuf->st_dev;
+	key->ino = statbuf->st_ino;
+	key->size = statbuf->st_size;
+	key->sec = statbuf->st_mtim.tv_sec;
+	key->nsec = statbuf->st_mtim.tv_nsec;
+	key->piecesize = piecesize;
+	key->piece = piece;
+	atomic_init(&key->gen, hc->gen);
+}
+
+/* first cache slot to probe for a key */
+size_t hc_hash(struct hc_slot *key)
+{
+	uint64_t h;
+
+	h = id_hash(key->dev, key->ino);
+	h ^= (key->piece + 1) * XXH_PRIME64_2 + key->piecesize;
+
+	return h ^ (h >> 31);
+}
+
+/* compare cache keys */
+bool hc_match(struct hc_slot *a, struct hc_slot *b)
+{
+	return (a->ino == b->ino) && (a->dev == b->dev) && (a->size == b->size)
+		&& (a->sec == b->sec) && (a->nsec == b->nsec)
+		&& (a->piecesize == b->piecesize) && (a->piece == b->piece);
+}
+
+/* look up the hash of a key */
+bool hc_get(struct hash_cache *hc, struct hc_slot *key, uint64_t *hash)
+{
+	size_t i, n;
+	unsigned int state;
+	struct hc_slot *slot;
+
+	i = hc_hash(key) & hc->mask;
+
+	for(n = 0; n < HC_PROBE; n++, i = (i + 1) & hc->mask)
+	{
+		slot = &hc->slots[i];
+
+		if((state = atomic_load(&slot->state)) == HC_EMPTY) return false;
+
+		if((state == HC_FULL) && hc_match(slot, key))
+		{
+			*hash = slot->hash;
+			atomic_store_explicit(&slot->gen, hc->gen, memory_order_relaxed);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/* add a key and its hash, other threads and processes may be adding at the same time */
+void hc_add(struct hash_cache *hc, struct hc_slot *key)
+{
+	size_t i, n;
+	unsigned int state;
+	struct hc_slot *slot;
+
+	/* a full cache waits for the next compaction */
+	if(atomic_load(&hc->head->used) * 4 >= hc->head->slots * 3)
+	{
+		if((!atomic_exchange(&hc->full, true)) && hc->verbose)
+			fputs("hash cache is full, new hashes are kept once it is compacted\n", stderr);
+		return;
+	}
+
+	i = hc_hash(key) & hc->mask;
+
+	for(n = 0; n < HC_PROBE; n++, i = (i + 1) & hc->mask)
+	{
+		slot = &hc->slots[i];
+		state = HC_EMPTY;
+
+		/* claim an empty slot, then fill it in before it can be seen */
+		if(atomic_compare_exchange_strong(&slot->state, &state, HC_BUSY))
+		{
+			slot->dev = key->dev;
+			slot->ino = key->ino;
+			slot->size = key->size;
+			slot->sec = key->sec;
+			slot->nsec = key->nsec;
+			slot->piecesize = key->piecesize;
+			slot->piece = key->piece;
+			slot->hash = key->hash;
+			atomic_store_explicit(&slot->gen, atomic_load_explicit(&key->gen, memory_order_relaxed), memory_order_relaxed);
+
+			atomic_store(&slot->state, HC_FULL);
+			atomic_fetch_add(&hc->head->used, 1);
+			return;
+		}
+
+		if((state == HC_FULL) && hc_match(slot, key)) return;
+	}
+}
+
+/* map the cache file, returns false if it is not a valid cache */
+bool hc_map(struct hash_cache *hc)
+{
+	struct stat st;
+	struct hc_head head;
+
+	if(fstat(hc->fd, &st) == -1) failed("get hash cache status");
+	if((size_t)st.st_size < HC_HEAD) return false;
+
+	if(pread(hc->fd, &head, sizeof(head), 0) != sizeof(head)) return false;
+	if(memcmp(head.magic, HC_MAGIC, sizeof(head.magic))) return false;
+	if((head.slots == 0) || (head.slots & (head.slots - 1))) return false;
+	if((uint64_t)st.st_size != HC_HEAD + head.slots * sizeof(struct hc_slot)) return false;
+
+	hc->len = st.st_size;
+	if((hc->head = mmap(NULL, hc->len, PROT_READ | PROT_WRITE, MAP_SHARED, hc->fd, 0)) == MAP_FAILED)
+		failed("map hash cache");
+
+	hc->slots = (struct hc_slot *)((char *)hc->head + HC_HEAD);
+	hc->mask = head.slots - 1;
+
+	return true;
+}
+
+/* set up an empty cache file, needs the exclusive lock */
+void hc_init(struct hash_cache *hc, uint64_t slots, unsigned int gen)
+{
+	struct hc_head head;
+
+	/* truncating first clears every slot */
+	if(ftruncate(hc->fd, 0) || ftruncate(hc->fd, HC_HEAD + slots * sizeof(struct hc_slot)))
+		failed("resize hash cache");
+
+	memset(&head, 0, sizeof(head));
+	memcpy(head.magic, HC_MAGIC, sizeof(head.magic));
+	head.slots = slots;
+	atomic_init(&head.used, 0);
+	atomic_init(&head.gen, gen);
+
+	if(pwrite(hc->fd, &head, sizeof(head), 0) != sizeof(head)) failed("write hash cache");
+
+	if(!hc_map(hc)) failed("set up hash cache");
+}
+
+/* drop entries that were not used for a while and resize the table, needs the exclusive lock */
+void hc_compact(struct hash_cache *hc)
+{
+	struct hc_slot *kept;
+	size_t i, count;
+	uint64_t slots;
+	unsigned int gen, state;
+
+	gen = atomic_load(&hc->head->gen);
+
+	if((kept = malloc((hc->mask + 1) * sizeof(struct hc_slot))) == NULL) failed("allocate hash cache");
+
+	/* slots still being written belong to runs that were interrupted */
+	for(i = count = 0; i <= hc->mask; i++)
+	{
+		state = atomic_load(&hc->slots[i].state);
+		if((state == HC_FULL) && (gen - atomic_load(&hc->slots[i].gen) < HC_KEEP))
+			memcpy(&kept[count++], &hc->slots[i], sizeof(struct hc_slot));
+	}
+
+	munmap(hc->head, hc->len);
+
+	/* the table is a quarter full after compaction */
+	for(slots = HC_SLOTS; slots < count * 4; slots *= 2);
+	hc_init(hc, slots, gen);
+
+	/* entries keep the run that last used them */
+	for(i = 0; i < count; i++) hc_add(hc, &kept[i]);
+
+	free(kept);
+}
+
+/* set up the cache, or compact it if it is more than half full, needs the exclusive lock */
+void hc_setup(struct hash_cache *hc)
+{
+	if(!hc_map(hc)) hc_init(hc, HC_SLOTS, 0);
+	else if(atomic_load(&hc->head->used) * 2 > hc->head->slots) hc_compact(hc);
+}
+
+/* open the hash cache, shared with other runs */
+struct hash_cache * hc_open(char *fn, bool verbose)
+{
+	struct hash_cache *hc;
+
+	if((hc = malloc(sizeof(struct hash_cache))) == NULL) failed("allocate hash cache");
+
+	atomic_init(&hc->full, false);
+	hc->verbose = verbose;
+
+	if((hc->fd = open(fn, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) == -1) failed("open hash cache");
+
+	/* only a run that has the cache to itself sets it up or compacts it */
+	if(flock(hc->fd, LOCK_EX | LOCK_NB) == 0)
+	{
+		hc_setup(hc);
+		munmap(hc->head, hc->len);
+	}
+	else if(errno != EWOULDBLOCK) failed("lock hash cache");
+
+	/* the cache is mapped once the shared lock is held, as turning the exclusive lock into it
+	 * lets go of it first, and another run can set the cache up again in between */
+	if(flock(hc->fd, LOCK_SH)) failed("lock hash cache");
+
+	if(!hc_map(hc))
+	{
+		errno = 0;
+		fail("invalid hash cache file");
+	}
+
+	/* entries used by this run are kept at the next compaction */
+	hc->gen = atomic_fetch_add(&hc->head->gen, 1) + 1;
+
+	return hc;
+}
+
+/* close the hash cache
+ * a run that filled it compacts it if it has the cache to itself by then */
+void hc_close(struct hash_cache *hc)
+{
+	if(atomic_load(&hc->full) && (flock(hc->fd, LOCK_EX | LOCK_NB) == 0))
+	{
+		/* the shared lock was let go first, the cache may have changed in between */
+		munmap(hc->head, hc->len);
+		hc_setup(hc);
+	}
+
+	munmap(hc->head, hc->len);
+	close(hc->fd);
+	free(hc);
+}
+
+/* check whether an open file still has the status it had before it was read */
+bool file_same(int fd, struct stat *statbuf)
+{
+	struct stat st;
+
+	if(fstat(fd, &st) == -1) return false;
+
+	return (st.st_ino == statbuf->st_ino) && (st.st_dev == statbuf->st_dev) && (st.st_size == statbuf->st_size)
+		&& (st.st_mtim.tv_sec == statbuf->st_mtim.tv_sec) && (st.st_mtim.tv_nsec == statbuf->st_mtim.tv_nsec);
+}
+
+/* copy a file hash */
+void hr_copy(struct hash_res *to, struct hash_res *from)
+{
+	if(to->space < from->pieces)
+		if((to->piece = realloc(to->piece, (to->space = from->pieces) * sizeof(uint64_t))) == NULL)
+			failed("allocate piece hashes");
+
+	to->ok = from->ok;
+	to->value = from->value;
+	to->pieces = from->pieces;
+	if(from->piece != NULL) memcpy(to->piece, from->piece, from->pieces * sizeof(uint64_t));
+}
+
+/* prepare map of files with several links */
+struct link_map * lm_prep(void)
+{
+	struct link_map *lm;
+
+	if((lm = malloc(sizeof(struct link_map))) == NULL) failed("allocate link map");
+	if(pthread_mutex_init(&lm->lock, NULL)) failed("initialize link map lock");
+
+	lm->count = 0;
+	lm->space = 1024;
+	if((lm->ents = calloc(lm->space, sizeof(struct link_ent *))) == NULL) failed("allocate link map");
+
+	return lm;
+}
+
+/* free map of files with several links */
+void lm_free(struct link_map *lm)
+{
+	size_t i;
+
+	for(i = 0; i < lm->space; i++)
+		if(lm->ents[i] != NULL)
+		{
+			free(lm->ents[i]->path);
+			free(lm->ents[i]->res.piece);
+			free(lm->ents[i]);
+		}
+
+	pthread_mutex_destroy(&lm->lock);
+	free(lm->ents);
+	free(lm);
+}
+
+/* find the slot of a file identity */
+struct link_ent ** lm_slot(struct link_ent **ents, size_t space, dev_t dev, ino_t ino)
+{
+	size_t i;
+
+	/* linear probing, space is a power of two */
+	for(i = id_hash(dev, ino) & (space - 1); ents[i] != NULL; i = (i + 1) & (space - 1))
+		if((ents[i]->ino == ino) && (ents[i]->dev == dev)) break;
+
+	return &ents[i];
+}
+
+/* find the entry of a file with several links, first is set if this is its first record */
+struct link_ent * lm_find(struct link_map *lm, char *fn, struct stat *statbuf, bool *first)
+{
+	size_t i, len;
+	struct link_ent **ents, **slot, *le;
+
+	pthread_mutex_lock(&lm->lock);
+
+	slot = lm_slot(lm->ents, lm->space, statbuf->st_dev, statbuf->st_ino);
+
+	if((*first = (*slot == NULL)))
+	{
+		if((le = calloc(1, sizeof(struct link_ent))) == NULL) failed("allocate link map entry");
+		le->dev = statbuf->st_dev;
+		le->ino = statbuf->st_ino;
+
+		len = strlen(fn);
+		if((le->path = malloc(len + 1)) == NULL) failed("allocate link map entry");
+		memcpy(le->path, fn, len + 1);
+
+		*slot = le;
+
+		/* keep the table at most half full */
+		if(++lm->count * 2 > lm->space)
+		{
+			if((ents = calloc(lm->space * 2, sizeof(struct link_ent *))) == NULL)
+				failed("allocate link map");
+			for(i = 0; i < lm->space; i++)
+				if(lm->ents[i] != NULL)
+					*lm_slot(ents, lm->space * 2, lm->ents[i]->dev, lm->ents[i]->ino) = lm->ents[i];
+			free(lm->ents);
+			lm->ents = ents;
+			lm->space *= 2;
+		}
+	}
+	else le = *slot;
+
+	pthread_mutex_unlock(&lm->lock);
+
+	return le;
+}
+
+/* the first record of a file with several links was hashed,
+ * give its hash to the other links, needs the hashing pool lock */
+void lm_done(struct link_ent *le, struct hash_res *res)
+{
+	struct hash_job *job;
+
+	hr_copy(&le->res, res);
+	le->done = true;
+
+	for(job = le->waiting; job != NULL; job = job->next)
+	{
+		hr_copy(&job->res, res);
+		atomic_store(&job->done, true);
+	}
+
+	le->waiting = NULL;
+}
+
+/* hash a range of an open file
+ * holes are hashed as zeros without reading them */
+bool hash_fd(int fd, char *fn, off_t off, uintmax_t len, unsigned char *buf, uint64_t *value, bool verbose)
+{
+	off_t end, data, hole;
+	ssize_t n;
+	struct stat statbuf;
+	struct xxh3 st;
+
+	end = off + len;
+
+	/* read ahead further, and don't keep the pages once they are hashed */
+	posix_fadvise(fd, off, len, POSIX_FADV_SEQUENTIAL);
+	posix_fadvise(fd, off, len, POSIX_FADV_NOREUSE);
+
+	xh_init(&st);
+
+	while(off < end)
+	{
+		/* find the next data, filesystems without holes report all of it as data */
+		if((data = lseek(fd, off, SEEK_DATA)) == -1)
+		{
+			if(errno != ENXIO) data = off;
+
+			/* the rest is a hole, unless the file became shorter */
+			else if((fstat(fd, &statbuf) == -1) || (statbuf.st_size < end))
+			{
+				if(verbose) fprintf(stderr, "%s: file changed while hashing\n", fn);
+				return false;
+			}
+			else data = end;
+		}
+		if(data > end) data = end;
+
+		/* hash the hole */
+		if(off < data)
+		{
+			xh_zeros(&st, data - off);
+			off = data;
+			if(off == end) break;
+		}
+
+		/* the data goes on to the next hole */
+		if(((hole = lseek(fd, off, SEEK_HOLE)) == -1) || (hole > end)) hole = end;
+
+		for(; off < hole; off += n)
+		{
+			if((n = pread(fd, buf, (hole - off < HASH_BUF) ? hole - off : HASH_BUF, off)) == -1)
+			{
+				if(errno == EINTR) {n = 0; continue;}
+				if(verbose) perror(fn);
+				return false;
+			}
+
+			/* the file became shorter than its recorded size */
+			if(n == 0)
+			{
+				if(verbose) fprintf(stderr, "%s: file changed while hashing\n", fn);
+				return false;
+			}
+
+			xh_update(&st, buf, n);
+		}
+	}
+
+	*value = xh_final(&st);
+	return true;
+}
+
+/* open a file to hash relative to its directory, AT_FDCWD for a path,
+ * it must still be the file that was examined, returns -1 on failure */
+int hash_open(int dfd, char *name, char *fn, struct stat *statbuf, bool verbose)
+{
+	int fd;
+	struct stat st;
+
+	if((fd = openat(dfd, name, O_RDONLY | O_NOCTTY | O_NONBLOCK | O_CLOEXEC)) == -1)
+	{
+		if(verbose) perror(fn);
+		return -1;
+	}
+
+	if((fstat(fd, &st) == -1) || (st.st_ino != statbuf->st_ino) || (st.st_dev != statbuf->st_dev))
+	{
+		if(verbose) fprintf(stderr, "%s: file changed while hashing\n", fn);
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/* hash the data of an open file to its end */
+bool hash_file(int fd, char *fn, unsigned char *buf, uint64_t *value, bool verbose)
+{
+	bool ok;
+	uint64_t start;
+	struct stat statbuf;
+
+	start = st_begin();
+	if(fstat(fd, &statbuf) == -1)
+	{
+		st_end(ST_HASH, start, true, 0);
+		if(verbose) perror(fn);
+		return false;
+	}
+
+	ok = hash_fd(fd, fn, 0, statbuf.st_size, buf, value, verbose);
+	st_end(ST_HASH, start, !ok, statbuf.st_size);
+
+	return ok;
+}
+
+/* hash one piece of an open file with positioned reads */
+bool hash_piece(int fd, char *fn, off_t off, uintmax_t len, unsigned char *buf, uint64_t *value, bool verbose)
+{
+	bool ok;
+	uint64_t start;
+
+	start = st_begin();
+	ok = hash_fd(fd, fn, off, len, buf, value, verbose);
+	st_end(ST_HASH, start, !ok, len);
+
+	return ok;
+}
+
+/* whole file hash, made from the piece hashes in piece mode */
+uint64_t hash_root(struct hash_res *hr, struct opt_struct *opts)
+{
+	struct xxh3 st;
+	unsigned char le[8];
+	size_t i;
+	int j;
+
+	if(!opts->piece) return hr->value;
+
+	/* a file with one piece has the same hash either way */
+	if(hr->pieces == 1) return hr->piece[0];
+
+	/* hash the piece hashes, as little-endian 64-bit numbers */
+	xh_init(&st);
+
+	for(i = 0; i < hr->pieces; i++)
+	{
+		for(j = 0; j < 8; j++) le[j] = hr->piece[i] >> (8 * j);
+		xh_update(&st, le, 8);
+	}
+
+	return xh_final(&st);
+}
+
+/* hashing thread, the pieces of one file can be hashed by several threads at once */
+void * hp_main(void *arg)
+{
+	struct hash_pool *hp = arg;
+	struct hash_job *job;
+	struct hc_slot key;
+	unsigned char *buf;
+	uintmax_t size, piece, off;
+	uint64_t *value;
+	size_t i;
+	bool ok;
+
+	if((buf = aligned_alloc(HASH_ALIGN, HASH_BUF)) == NULL) failed("allocate hash buffer");
+
+	piece = hp->opts->piece;
+
+	pthread_mutex_lock(&hp->lock);
+
+	while(true)
+	{
+		while((hp->first == NULL) && !hp->closing) pthread_cond_wait(&hp->more, &hp->lock);
+		if((job = hp->first) == NULL) break;
+
+		/* the file leaves the queue once all of its pieces are taken */
+		i = job->taken++;
+		if(job->taken == job->res.pieces)
+			if((hp->first = job->next) == NULL) hp->last = NULL;
+
+		pthread_mutex_unlock(&hp->lock);
+
+		value = piece ? &job->res.piece[i] : &job->res.value;
+		size = job->statbuf.st_size;
+		off = i * piece;
+		if(hp->cache != NULL) hc_key(hp->cache, &key, &job->statbuf, piece, i);
+
+		/* an earlier run might have hashed it already */
+		if((hp->cache != NULL) && hc_get(hp->cache, &key, value)) ok = true;
+
+		/* the file could not be opened when it was queued */
+		else if(job->fd == -1) ok = false;
+
+		else
+		{
+			if(piece)
+			{
+				ok = hash_piece(job->fd, job->text, off, (size - off < piece) ? size - off : piece,
+					buf, value, hp->opts->verbose);
+			}
+			else ok = hash_file(job->fd, job->text, buf, value, hp->opts->verbose);
+
+			/* only cache hashes of files that did not change while they were read */
+			if(ok && (hp->cache != NULL) && file_same(job->fd, &job->statbuf))
+			{
+				key.hash = *value;
+				hc_add(hp->cache, &key);
+			}
+		}
+
+		/* cached hashes count as hashed for the progress */
+		pg_count(PG_HASHED, piece ? ((size - off < piece) ? size - off : piece) : size);
+
+		pthread_mutex_lock(&hp->lock);
+
+		if(!ok) job->res.ok = false;
+
+		/* the job's output window might be waiting for it */
+		if(--job->left == 0)
+		{
+			/* the last piece closes the file, a file waiting to be queued can be opened */
+			if(job->fd != -1)
+			{
+				close(job->fd);
+				job->fd = -1;
+				hp->fds--;
+			}
+
+			/* other links of the file get the same hash */
+			if(job->link != NULL) lm_done(job->link, &job->res);
+
+			atomic_store(&job->done, true);
+			pthread_cond_broadcast(&hp->done);
+		}
+	}
+
+	pthread_mutex_unlock(&hp->lock);
+	free(buf);
+
+	return NULL;
+}
+
+/* start the hashing threads */
+struct hash_pool * hp_prep(struct opt_struct *opts)
+{
+	unsigned int i;
+	struct hash_pool *hp;
+	struct rlimit rl;
+
+	if((hp = malloc(sizeof(struct hash_pool))) == NULL) failed("allocate hashing pool");
+
+	hp->opts = opts;
+	hp->count = opts->threads;
+	hp->first = hp->last = NULL;
+	hp->closing = false;
+
+	/* the rest of the descriptors are left for directories and the output */
+	hp->fds = 0;
+	hp->fd_max = HASH_FDS;
+	if((getrlimit(RLIMIT_NOFILE, &rl) == 0) && (rl.rlim_cur != RLIM_INFINITY) && (rl.rlim_cur / 2 < hp->fd_max))
+		hp->fd_max = (rl.rlim_cur / 2) ? rl.rlim_cur / 2 : 1;
+	hp->cache = (opts->cache_fn != NULL) ? hc_open(opts->cache_fn, opts->verbose) : NULL;
+
+	if(pthread_mutex_init(&hp->lock, NULL)) failed("initialize hashing pool lock");
+	if(pthread_cond_init(&hp->more, NULL)) failed("initialize hashing pool condition");
+	if(pthread_cond_init(&hp->done, NULL)) failed("initialize hashing pool condition");
+
+	if((hp->threads = malloc(hp->count * sizeof(pthread_t))) == NULL)
+		failed("allocate hashing threads");
+
+	for(i = 0; i < hp->count; i++)
+		if(pthread_create(&hp->threads[i], NULL, hp_main, hp))
+			failed("create hashing thread");
+
+	return hp;
+}
+
+/* stop the hashing threads, the queue must be empty */
+void hp_free(struct hash_pool *hp)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&hp->lock);
+	hp->closing = true;
+	pthread_cond_broadcast(&hp->more);
+	pthread_mutex_unlock(&hp->lock);
+
+	for(i = 0; i < hp->count; i++) pthread_join(hp->threads[i], NULL);
+
+	if(hp->cache != NULL) hc_close(hp->cache);
+
+	pthread_cond_destroy(&hp->done);
+	pthread_cond_destroy(&hp->more);
+	pthread_mutex_destroy(&hp->lock);
+	free(hp->threads);
+	free(hp);
+}
+
+/* prepare output window */
+struct hash_win * hw_prep(struct hash_pool *hp)
+{
+	struct hash_win *hw;
+
+	if((hw = calloc(1, sizeof(struct hash_win))) == NULL) failed("allocate output window");
+	hw->hp = hp;
+
+	return hw;
+}
+
+/* free output window, it must be empty */
+void hw_free(struct hash_win *hw)
+{
+	size_t i;
+
+	for(i = 0; i < HASH_WIN; i++)
+	{
+		free(hw->jobs[i].text);
+		free(hw->jobs[i].res.piece);
+	}
+	free(hw);
+}
+
+/* wait until a file is hashed */
+void hw_wait(struct hash_win *hw, struct hash_job *job)
+{
+	if(atomic_load(&job->done)) return;
+
+	pthread_mutex_lock(&hw->hp->lock);
+	while(!atomic_load(&job->done)) pthread_cond_wait(&hw->hp->done, &hw->hp->lock);
+	pthread_mutex_unlock(&hw->hp->lock);
+}
+
+/* read a 64-bit hexadecimal number, returns the end or NULL if there is none */
+char * get_hex(char *p, char *end, uint64_t *n)
+{
+	char *start = p;
+	uint64_t v = 0;
+	int d;
+
+	for(; p < end; p++)
+	{
+		if((*p >= '0') && (*p <= '9')) d = *p - '0';
+		else if((*p >= 'A') && (*p <= 'F')) d = *p - 'A' + 10;
+		else if((*p >= 'a') && (*p <= 'f')) d = *p - 'a' + 10;
+		else break;
+
+		if(p - start == 16) return NULL;
+		v = (v << 4) | d;
+	}
+
+	if(p == start) return NULL;
+
+	*n = v;
+	return p;
+}
+
+/* reject an invalid input manifest */
+void bad_input(char *message)
+{
+	fputs(message, stderr);
+	putc('\n', stderr);
+	exit(EXIT_FAILURE);
+}
+
+/* read a decimal number, returns the end or NULL if there is none */
+char * get_uint(char *p, char *end, uintmax_t *n)
+{
+	char *start = p;
+	uintmax_t v = 0;
+
+	while((p < end) && (*p >= '0') && (*p <= '9'))
+	{
+		if(v > (UINTMAX_MAX - 9) / 10) return NULL;
+		v = v * 10 + (*p++ - '0');
+	}
+
+	if(p == start) return NULL;
+
+	*n = v;
+	return p;
+}
+
+/* check whether a field starts with an element */
+bool is_elem(char *p, char *eol, char *elem, size_t len)
+{
+	if((size_t)(eol - p) < len) return false;
+	if(memcmp(p, elem, len)) return false;
+
+	return (p + len == eol) || (p[len] == ' ');
+}
+
+/* read a time in seconds with optional nanoseconds, returns false if it is invalid */
+bool get_time(char *p, char *eol, struct timespec *ts)
+{
+	uintmax_t n;
+
+	if((p = get_uint(p, eol, &n)) == NULL) return false;
+	ts->tv_sec = n;
+	ts->tv_nsec = 0;
+
+	if(p == eol) return true;
+
+	if((*p != ' ') || (get_uint(p + 1, eol, &n) != eol) || (n >= 1000000000)) return false;
+	ts->tv_nsec = n;
+
+	return true;
+}
+
+/* prepare a record for parsing, front says whether paths are front-coded */
+void mr_init(struct man_rec *mr, bool front)
+{
+	mr->front = front;
+	mr->prev = mr->cur = NULL;
+	mr->prev_len = mr->prev_space = mr->cur_space = 0;
+}
+
+/* free the paths kept by a record */
+void mr_free(struct man_rec *mr)
+{
+	free(mr->prev);
+	free(mr->cur);
+}
+
+/* parse one record, returns its length or 0 if it is incomplete */
+size_t mr_parse(char *start, char *end, bool at_eof, struct man_rec *mr)
+{
+	char *p, *q, *eol, *data, *swap;
+	uintmax_t len, n;
+	uint64_t n64;
+	size_t space;
+
+	mr->type = NULL;
+	mr->type_len = 0;
+	mr->path = NULL;
+	mr->path_len = 0;
+	mr->pfield = NULL;
+	mr->shared = 0;
+	mr->front_header = false;
+	mr->has_size = mr->has_mtime = mr->has_hash = mr->has_phash = mr->has_hmtime = mr->has_hsize = false;
+	mr->phash = NULL;
+	mr->phashes = 0;
+	mr->has_piecesize = false;
+	mr->end = mr->closed = false;
+
+	for(p = start; ; p = eol + 1)
+	{
+		/* the last record may lack its empty field at the end of the input */
+		if(p >= end)
+		{
+			if(at_eof && (mr->type != NULL)) break;
+			if(at_eof && (p > start)) bad_input("truncated manifest record");
+			return 0;
+		}
+
+		/* an empty field ends the record */
+		if(*p == '\n')
+		{
+			if(mr->type == NULL) bad_input("empty manifest record");
+			mr->closed = true;
+			p++;
+			break;
+		}
+
+		if((eol = memchr(p, '\n', end - p)) == NULL)
+		{
+			if(at_eof) bad_input("truncated manifest record");
+			return 0;
+		}
+
+		/* record type indicator */
+		if(mr->type == NULL)
+		{
+			mr->type = p;
+			mr->type_len = eol - p;
+
+			/* an end record has no fields, arbitrary data may follow it */
+			if(is_elem(p, eol, "end", 3) && (eol - p == 3))
+			{
+				mr->end = mr->closed = true;
+				p = eol + 1;
+				break;
+			}
+
+			continue;
+		}
+
+		/* data field, the data follows on the next line */
+		if(is_elem(p, eol, "data", 4))
+		{
+			if(((q = get_uint(p + 5, eol, &len)) == NULL) || (q >= eol) || (*q != ' '))
+				bad_input("invalid data field");
+
+			data = eol + 1;
+			if((uintmax_t)(end - data) <= len)
+			{
+				if(at_eof) bad_input("truncated data field");
+				return 0;
+			}
+			if(data[len] != '\n') bad_input("invalid data field");
+
+			if(is_elem(q + 1, eol, "path", 4))
+			{
+				mr->path = data;
+				mr->path_len = len;
+				mr->pfield = p;
+				mr->pfield_len = data + len + 1 - p;
+				mr->shared = 0;
+			}
+
+			/* front-coded path, the data follows the part shared with the previous path */
+			else if(is_elem(q + 1, eol, "fpath", 5))
+			{
+				if(!mr->front || (q + 6 == eol) || (get_uint(q + 7, eol, &n) != eol) || (n > mr->prev_len))
+					bad_input("invalid path field");
+
+				mr->path = data;
+				mr->path_len = len;
+				mr->pfield = p;
+				mr->pfield_len = data + len + 1 - p;
+				mr->shared = n;
+			}
+
+			eol = data + len;
+		}
+
+		/* file size */
+		else if(is_elem(p, eol, "size", 4))
+		{
+			if(get_uint(p + 5, eol, &mr->size) != eol) bad_input("invalid size field");
+			mr->has_size = true;
+		}
+
+		/* modification time */
+		else if(is_elem(p, eol, "mtime", 5))
+		{
+			if(!get_time(p + 6, eol, &mr->mtime)) bad_input("invalid mtime field");
+			mr->has_mtime = true;
+		}
+
+		/* file hash, other hash types are not used */
+		else if(is_elem(p, eol, "hash", 4))
+		{
+			if(is_elem(p + 5, eol, "xxh3", 4))
+			{
+				if(get_hex(p + 10, eol, &mr->hash) != eol) bad_input("invalid hash field");
+				mr->has_hash = true;
+			}
+		}
+
+		/* piece hash, only a consecutive series can be used again */
+		else if(is_elem(p, eol, "phash", 5))
+		{
+			if(is_elem(p + 6, eol, "xxh3", 4))
+			{
+				if((eol - p != 27) || (get_hex(p + 11, eol, &n64) != eol)) bad_input("invalid phash field");
+
+				if(!mr->has_phash) mr->phash = p;
+				else if(mr->phash + 28 * mr->phashes != p) mr->phash = NULL;
+
+				mr->has_phash = true;
+				mr->phashes++;
+			}
+		}
+
+		/* modification time of the file when it was hashed */
+		else if(is_elem(p, eol, "hash-mtime", 10))
+		{
+			if(is_elem(p + 11, eol, "xxh3", 4))
+			{
+				if(!get_time(p + 16, eol, &mr->hmtime)) bad_input("invalid hash-mtime field");
+				mr->has_hmtime = true;
+			}
+		}
+
+		/* size of the file when it was hashed */
+		else if(is_elem(p, eol, "hash-size", 9))
+		{
+			if(is_elem(p + 10, eol, "xxh3", 4))
+			{
+				if(get_uint(p + 15, eol, &mr->hsize) != eol) bad_input("invalid hash-size field");
+				mr->has_hsize = true;
+			}
+		}
+
+		/* piece size of a hash record */
+		else if(is_elem(p, eol, "piecesize", 9))
+		{
+			if(get_uint(p + 10, eol, &mr->piecesize) != eol) bad_input("invalid piecesize field");
+			mr->has_piecesize = true;
+		}
+
+		/* path encoding of a header record */
+		else if(is_elem(p, eol, "paths", 5))
+			mr->front_header = is_elem(p + 6, eol, "front", 5) && (eol - p == 11);
+	}
+
+	/* put the whole path together, only once the record is complete */
+	if(mr->front && (mr->path != NULL))
+	{
+		if(mr->cur_space < mr->shared + mr->path_len + 1)
+			if((mr->cur = realloc(mr->cur, mr->cur_space = mr->shared + mr->path_len + 1)) == NULL)
+				failed("allocate input path");
+
+		if(mr->shared) memcpy(mr->cur, mr->prev, mr->shared);
+		memcpy(mr->cur + mr->shared, mr->path, mr->path_len);
+
+		/* it becomes the previous path */
+		swap = mr->prev;
+		mr->prev = mr->cur;
+		mr->cur = swap;
+		space = mr->prev_space;
+		mr->prev_space = mr->cur_space;
+		mr->cur_space = space;
+
+		mr->path = mr->prev;
+		mr->path_len = mr->prev_len = mr->shared + mr->path_len;
+	}
+
+	mr->rec = start;
+	mr->rec_len = p - start;
+
+	return p - start;
+}
+
+/* prepare path index of the output manifest */
+struct path_index * ix_prep(char *fn)
+{
+	struct path_index *ix;
+
+	if((ix = malloc(sizeof(struct path_index))) == NULL) failed("allocate path index");
+
+	ix->fn = fn;
+	ix->ents = NULL;
+	ix->count = ix->space = 0;
+
+	return ix;
+}
+
+/* find the file records of an output buffer for the path index, at offsets within the buffer
+ * with front-coded paths, the first path of the buffer is whole */
+void ix_scan(struct out_buf *ob)
+{
+	struct man_rec mr;
+	size_t pos, n, start = 0;
+
+	mr_init(&mr, ob->of->front);
+	ob->ix_count = 0;
+
+	/* the buffer holds whole records */
+	for(pos = 0; pos < ob->len; pos += n)
+	{
+		n = mr_parse(ob->buf + pos, ob->buf + ob->len, true, &mr);
+
+		if(mr.path == NULL) continue;
+		if(mr.shared == 0) start = pos;
+
+		if(ob->ix_count == ob->ix_space)
+			if((ob->ix_ents = realloc(ob->ix_ents, (ob->ix_space = ob->ix_space ? ob->ix_space * 2 : 1024) * sizeof(struct ix_ent))) == NULL)
+				failed("allocate path index");
+
+		ob->ix_ents[ob->ix_count].hash = xh_hash(mr.path, mr.path_len);
+		ob->ix_ents[ob->ix_count].off = pos;
+		ob->ix_ents[ob->ix_count].start = start;
+		ob->ix_count++;
+	}
+
+	mr_free(&mr);
+}
+
+/* add the entries of an output buffer to the path index, base is where the buffer goes in the output,
+ * needs the output lock */
+void ix_add(struct path_index *ix, struct out_buf *ob, uint64_t base)
+{
+	size_t i;
+
+	if(ix->count + ob->ix_count > ix->space)
+	{
+		for(ix->space = ix->space ? ix->space : 4096; ix->count + ob->ix_count > ix->space; ix->space *= 2);
+		if((ix->ents = realloc(ix->ents, ix->space * sizeof(struct ix_ent))) == NULL) failed("allocate path index");
+	}
+
+	for(i = 0; i < ob->ix_count; i++)
+	{
+		ix->ents[ix->count].hash = ob->ix_ents[i].hash;
+		ix->ents[ix->count].off = base + ob->ix_ents[i].off;
+		ix->ents[ix->count].start = base + ob->ix_ents[i].start;
+		ix->count++;
+	}
+}
+
+/* compare path index entries by path hash, then by offset */
+int ix_cmp(const void *a, const void *b)
+{
+	const struct ix_ent *x = a, *y = b;
+
+	if(x->hash != y->hash) return (x->hash < y->hash) ? -1 : 1;
+	if(x->off != y->off) return (x->off < y->off) ? -1 : 1;
+	return 0;
+}
+
+/* write all of a buffer to a file */
+void ix_put(int fd, void *buf, size_t len)
+{
+	size_t done;
+	ssize_t n;
+
+	for(done = 0; done < len; done += n)
+		if((n = write(fd, (char *)buf + done, len - done)) == -1)
+		{
+			if(errno == EINTR) n = 0;
+			else failed("write path index");
+		}
+}
+
+/* sort and write out the path index of a manifest of the given size, then free it */
+void ix_write(struct path_index *ix, uint64_t size)
+{
+	int fd;
+	struct ix_head head;
+
+	qsort(ix->ents, ix->count, sizeof(struct ix_ent), ix_cmp);
+
+	memset(&head, 0, sizeof(head));
+	memcpy(head.magic, IX_MAGIC, sizeof(head.magic));
+	head.count = ix->count;
+	head.size = size;
+
+	if((fd = open(ix->fn, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) == -1) failed("open path index");
+
+	ix_put(fd, &head, sizeof(head));
+	ix_put(fd, ix->ents, ix->count * sizeof(struct ix_ent));
+
+	if(close(fd)) failed("write path index");
+
+	free(ix->ents);
+	free(ix);
+}
+
+/* prepare output buffer */
+struct out_buf * ob_prep(struct out_file *of)
+{
+	struct out_buf *ob;
+
+	if((ob = malloc(sizeof(struct out_buf))) == NULL) failed("allocate output buffer");
+	if((ob->buf = malloc(OUT_SIZE)) == NULL) failed("allocate output buffer");
+	ob->of = of;
+	ob->len = 0;
+	ob->space = OUT_SIZE;
+	ob->hw = (of->hp != NULL) ? hw_prep(of->hp) : NULL;
+	ob->last = NULL;
+	ob->last_len = ob->last_space = ob->run = 0;
+	ob->ix_ents = NULL;
+	ob->ix_count = ob->ix_space = 0;
+
+	return ob;
+}
+
+/* write out buffered records */
+void ob_flush(struct out_buf *ob)
+{
+	size_t done;
+	ssize_t n;
+	uint64_t start;
+
+	if(ob->len == 0) return;
+
+	/* the records are found before taking the lock, only where the buffer goes is left for then */
+	if(ob->of->index != NULL) ix_scan(ob);
+
+	/* buffers of different threads take turns */
+	pthread_mutex_lock(&ob->of->lock);
+
+	if(ob->of->index != NULL) ix_add(ob->of->index, ob, ob->of->pos);
+	ob->of->pos += ob->len;
+
+	start = st_begin();
+	for(done = 0; done < ob->len; done += n)
+		if((n = write(ob->of->fd, ob->buf + done, ob->len - done)) == -1)
+		{
+			if(errno == EINTR) n = 0;
+			else failed("write manifest");
+		}
+	st_end(ST_WRITE, start, false, ob->len);
+
+	pthread_mutex_unlock(&ob->of->lock);
+
+	ob->len = 0;
+	ob->run = 0;
+}
+
+/* make room for n more bytes, returns where they go */
+char * ob_need(struct out_buf *ob, size_t n)
+{
+	if(ob->space - ob->len < n)
+	{
+		ob_flush(ob);
+
+		/* a single record larger than the buffer */
+		if(ob->space < n)
+			if((ob->buf = realloc(ob->buf, ob->space = n)) == NULL)
+				failed("allocate output buffer");
+	}
+
+	return ob->buf + ob->len;
+}
+
+/* append bytes to the output buffer */
+void ob_write(struct out_buf *ob, char *s, size_t n)
+{
+	memcpy(ob_need(ob, n), s, n);
+	ob->len += n;
+}
+
+/* put a string, returns the end */
+char * put_str(char *p, char *s, size_t n)
+{
+	memcpy(p, s, n);
+	return p + n;
+}
+
+/* put a decimal number, returns the end */
+char * put_uint(char *p, uintmax_t n)
+{
+	char digits[24], *d;
+	size_t len;
+
+	/* convert from the last digit */
+	d = digits + sizeof(digits);
+	do *--d = '0' + (n % 10);
+	while(n /= 10);
+
+	len = digits + sizeof(digits) - d;
+	memcpy(p, d, len);
+
+	return p + len;
+}
+
+/* put a 64-bit number in hexadecimal with capital digits, returns the end */
+char * put_hex(char *p, uint64_t n)
+{
+	int i;
+
+	for(i = 60; i >= 0; i -= 4) *p++ = "0123456789ABCDEF"[(n >> i) & 15];
+
+	return p;
+}
+
+/* put a path field, returns the end
+ * in a front-coded manifest, only the part that differs from the previous path of the buffer is put,
+ * the first path of a buffer is whole, and so is every FC_RESTART-th one, so that reading can start there */
+char * put_path(struct out_buf *ob, char *p, char *path, size_t len)
+{
+	size_t shared = 0;
+
+	if(ob->of->front)
+	{
+		if(ob->run++ % FC_RESTART)
+			while((shared < len) && (shared < ob->last_len) && (path[shared] == ob->last[shared])) shared++;
+
+		if(ob->last_space < len + 1)
+			if((ob->last = realloc(ob->last, ob->last_space = len + 1)) == NULL)
+				failed("allocate output buffer");
+
+		memcpy(ob->last, path, len);
+		ob->last_len = len;
+	}
+
+	p = put_str(p, "data ", 5);
+	p = put_uint(p, len - shared);
+
+	if(shared)
+	{
+		p = put_str(p, " fpath ", 7);
+		p = put_uint(p, shared);
+		*p++ = '\n';
+	}
+	else p = put_str(p, " path\n", 6);
+
+	p = put_str(p, path + shared, len - shared);
+	*p++ = '\n';
+
+	return p;
+}
+
+/* write the header record */
+void w_header(struct out_buf *ob)
+{
+	if(ob->of->front) ob_write(ob, "OUmanifest 1\npaths front\n\n", 26);
+	else ob_write(ob, "OUmanifest 1\n\n", 14);
+}
+
+/* write a copied record, the path field is put again for the output
+ * head and tail are the fields before and after it, path is NULL if the record has none */
+void w_copy(struct out_buf *ob, char *head, size_t head_len, char *path, size_t path_len, char *tail, size_t tail_len, bool closed)
+{
+	char *p;
+
+	p = ob_need(ob, head_len + path_len + tail_len + 48);
+	p = put_str(p, head, head_len);
+	if(path != NULL) p = put_path(ob, p, path, path_len);
+	p = put_str(p, tail, tail_len);
+
+	/* the last record of the input may lack its empty field */
+	if(!closed) *p++ = '\n';
+
+	ob->len = p - ob->buf;
+}
+
+/* write file record, the hash is NULL if the file is not hashed
+ * ref is the path of an earlier record of the same file, NULL if there is none */
+void w_record(char *fn, char *ref, struct stat *statbuf, struct hash_res *hr, struct opt_struct *opts, struct out_buf *ob)
+{
+	char *type, *p;
+	size_t fn_len, t_len, r_len, i;
+
+	/* determine file type */
+	if((type = file_type(statbuf, opts)) == NULL) return;
+
+	fn_len = strlen(fn);
+	t_len = strlen(type);
+	r_len = (ref != NULL) ? strlen(ref) : 0;
+
+	/* room for the whole record, numbers have at most 20 digits */
+	p = ob_need(ob, fn_len + t_len + r_len + 280 + ((hr != NULL) ? hr->pieces * 32 : 0));
+
+	/* write file type indicator */
+	p = put_str(p, "file ", 5);
+	p = put_str(p, type, t_len);
+	*p++ = '\n';
+
+	/* write file path */
+	p = put_path(ob, p, fn, fn_len);
+
+	/* write file size */
+	if(opts->size)
+	{
+		p = put_str(p, "size ", 5);
+		p = put_uint(p, statbuf->st_size);
+		*p++ = '\n';
+	}
+
+	/* write modification time */
+	if(opts->mtime)
+	{
+		p = put_str(p, "mtime ", 6);
+		p = put_uint(p, statbuf->st_mtim.tv_sec);
+		*p++ = ' ';
+		p = put_uint(p, statbuf->st_mtim.tv_nsec);
+		*p++ = '\n';
+	}
+
+	/* write link reference, the hashes are in the other record */
+	if(ref != NULL)
+	{
+		p = put_str(p, "data ", 5);
+		p = put_uint(p, r_len);
+		p = put_str(p, " link\n", 6);
+		p = put_str(p, ref, r_len);
+		*p++ = '\n';
+	}
+
+	/* write the modification time and size the hashes belong to */
+	if((hr != NULL) && hr->ok)
+	{
+		p = put_str(p, "hash-mtime xxh3 ", 16);
+		p = put_uint(p, statbuf->st_mtim.tv_sec);
+		*p++ = ' ';
+		p = put_uint(p, statbuf->st_mtim.tv_nsec);
+		*p++ = '\n';
+
+		p = put_str(p, "hash-size xxh3 ", 15);
+		p = put_uint(p, statbuf->st_size);
+		*p++ = '\n';
+	}
+
+	/* write file hash */
+	if((hr != NULL) && hr->ok && opts->hash)
+	{
+		p = put_str(p, "hash xxh3 ", 10);
+		p = put_hex(p, hash_root(hr, opts));
+		*p++ = '\n';
+	}
+
+	/* write piece hashes */
+	if((hr != NULL) && hr->ok && opts->piece)
+		for(i = 0; i < hr->pieces; i++)
+		{
+			p = put_str(p, "phash xxh3 ", 11);
+			p = put_hex(p, hr->piece[i]);
+			*p++ = '\n';
+		}
+
+	/* end file record */
+	*p++ = '\n';
+
+	ob->len = p - ob->buf;
+}
+
+/* write records from the front of the output window
+ * only the finished ones, or all of them after waiting */
+void hw_emit(struct out_buf *ob, bool all)
+{
+	struct hash_win *hw = ob->hw;
+	struct hash_job *job;
+
+	while(hw->count)
+	{
+		job = &hw->jobs[hw->head];
+
+		if(all) hw_wait(hw, job);
+		else if(!atomic_load(&job->done)) break;
+
+		if(job->copy)
+			w_copy(ob, job->text, job->c_head, (job->c_head < job->len) ? job->text + job->c_head : NULL, job->c_path,
+				job->text + job->c_head + job->c_path, job->len - job->c_head - job->c_path, true);
+		else w_record(job->text, job->ref, &job->statbuf, job->hash ? &job->res : NULL, hw->hp->opts, ob);
+
+		hw->head = (hw->head + 1) % HASH_WIN;
+		hw->count--;
+	}
+}
+
+/* take the next job of the output window, with room for n bytes of path or record */
+struct hash_job * hw_slot(struct out_buf *ob, size_t n)
+{
+	struct hash_win *hw = ob->hw;
+	struct hash_job *job;
+
+	/* a full window waits for its oldest record */
+	if(hw->count == HASH_WIN)
+	{
+		hw_wait(hw, &hw->jobs[hw->head]);
+		hw_emit(ob, false);
+	}
+
+	job = &hw->jobs[(hw->head + hw->count++) % HASH_WIN];
+
+	if(job->space < n)
+		if((job->text = realloc(job->text, job->space = n)) == NULL)
+			failed("allocate output window");
+
+	return job;
+}
+
+/* take the next job of the output window for a file record */
+struct hash_job * hw_rec(struct out_buf *ob, char *fn, struct stat *statbuf)
+{
+	struct hash_job *job;
+	size_t len;
+
+	len = strlen(fn);
+	job = hw_slot(ob, len + 1);
+	memcpy(job->text, fn, len + 1);
+	job->len = len;
+	job->copy = false;
+	job->statbuf = *statbuf;
+	job->fd = -1;
+	job->link = NULL;
+	job->ref = NULL;
+
+	return job;
+}
+
+/* queue a file record, regular files are hashed first
+ * flc is the traversal that found the file, NULL for a file on the command line */
+void hw_file(struct out_buf *ob, struct file_list_con *flc, char *fn, struct stat *statbuf)
+{
+	struct hash_pool *hp = ob->hw->hp;
+	struct hash_job *job;
+	struct link_ent *le;
+	size_t pieces;
+	int dfd;
+	bool first;
+
+	job = hw_rec(ob, fn, statbuf);
+	job->hash = S_ISREG(statbuf->st_mode);
+
+	/* a file with several links is only hashed for its first record */
+	if(job->hash && (statbuf->st_nlink > 1))
+	{
+		le = lm_find(ob->of->links, fn, statbuf, &first);
+
+		if(first) job->link = le;
+
+		/* a link reference replaces the hashes */
+		else if(hp->opts->links)
+		{
+			job->ref = le->path;
+			job->hash = false;
+		}
+
+		/* wait for the hash of the first record */
+		else
+		{
+			pthread_mutex_lock(&hp->lock);
+
+			if(le->done)
+			{
+				hr_copy(&job->res, &le->res);
+				atomic_store(&job->done, true);
+			}
+			else
+			{
+				atomic_store(&job->done, false);
+				job->next = le->waiting;
+				le->waiting = job;
+			}
+
+			pthread_mutex_unlock(&hp->lock);
+
+			hw_emit(ob, false);
+			return;
+		}
+	}
+
+	if(job->hash)
+	{
+		pieces = file_pieces(statbuf, hp->opts);
+
+		if(hp->opts->piece && (job->res.space < pieces))
+			if((job->res.piece = realloc(job->res.piece, (job->res.space = pieces) * sizeof(uint64_t))) == NULL)
+				failed("allocate piece hashes");
+
+		pg_count(PG_QUEUED, statbuf->st_size);
+
+		/* wait for files of the queue to be closed */
+		pthread_mutex_lock(&hp->lock);
+		while(hp->fds == hp->fd_max) pthread_cond_wait(&hp->done, &hp->lock);
+		hp->fds++;
+		pthread_mutex_unlock(&hp->lock);
+
+		/* the file is opened while its directory is, and its pieces share it */
+		if((flc != NULL) && ((dfd = fl_dirfd(flc)) != -1)) job->fd = hash_open(dfd, flc->name, fn, statbuf, hp->opts->verbose);
+		else job->fd = hash_open(AT_FDCWD, fn, fn, statbuf, hp->opts->verbose);
+
+		if(job->fd == -1)
+		{
+			pthread_mutex_lock(&hp->lock);
+			hp->fds--;
+			pthread_mutex_unlock(&hp->lock);
+		}
+
+		job->res.ok = true;
+		job->res.pieces = pieces;
+		job->taken = 0;
+		job->left = pieces;
+		atomic_store(&job->done, false);
+		job->next = NULL;
+
+		pthread_mutex_lock(&hp->lock);
+		if(hp->last != NULL) hp->last->next = job;
+		else hp->first = job;
+		hp->last = job;
+		pthread_cond_signal(&hp->more);
+		pthread_mutex_unlock(&hp->lock);
+	}
+	else atomic_store(&job->done, true);
+
+	hw_emit(ob, false);
+}
+
+/* queue a file record with the hashes of an input record, the file is not read */
+void hw_kept(struct out_buf *ob, char *fn, struct stat *statbuf, struct man_rec *mr)
+{
+	struct hash_job *job;
+	struct link_ent *le;
+	char *p;
+	size_t i;
+	bool first;
+
+	job = hw_rec(ob, fn, statbuf);
+	job->hash = true;
+	job->res.ok = true;
+	job->res.value = mr->hash;
+	job->res.pieces = mr->phashes;
+
+	if(job->res.space < mr->phashes)
+		if((job->res.piece = realloc(job->res.piece, (job->res.space = mr->phashes) * sizeof(uint64_t))) == NULL)
+			failed("allocate piece hashes");
+
+	/* the piece hash fields were checked when the record was read */
+	for(i = 0, p = mr->phash; i < mr->phashes; i++)
+		p = get_hex(p + 11, p + 27, &job->res.piece[i]) + 1;
+
+	/* other links of the file can use the hash too */
+	if(S_ISREG(statbuf->st_mode) && (statbuf->st_nlink > 1))
+	{
+		le = lm_find(ob->of->links, fn, statbuf, &first);
+
+		if(first)
+		{
+			pthread_mutex_lock(&ob->hw->hp->lock);
+			lm_done(le, &job->res);
+			pthread_mutex_unlock(&ob->hw->hp->lock);
+		}
+	}
+
+	atomic_store(&job->done, true);
+
+	hw_emit(ob, false);
+}
+
+/* queue a copy of an input record */
+void hw_copy(struct out_buf *ob, struct man_rec *mr)
+{
+	struct hash_job *job;
+	char *p;
+
+	job = hw_slot(ob, mr->rec_len + mr->path_len + 1);
+
+	/* the path is kept whole, it is put again when the record is written */
+	if(mr->path != NULL)
+	{
+		job->c_head = mr->pfield - mr->rec;
+		job->c_path = mr->path_len;
+		p = put_str(job->text, mr->rec, job->c_head);
+		p = put_str(p, mr->path, mr->path_len);
+		p = put_str(p, mr->pfield + mr->pfield_len, mr->rec + mr->rec_len - (mr->pfield + mr->pfield_len));
+	}
+	else
+	{
+		job->c_head = mr->rec_len;
+		job->c_path = 0;
+		p = put_str(job->text, mr->rec, mr->rec_len);
+	}
+
+	/* the last record of the input may lack its empty field */
+	if(!mr->closed) *p++ = '\n';
+
+	job->len = p - job->text;
+
+	job->copy = true;
+	job->hash = false;
+	atomic_store(&job->done, true);
+
+	hw_emit(ob, false);
+}
+
+/* write the hash record that describes the hash fields */
+void w_hash_r(struct opt_struct *opts, struct out_buf *ob)
+{
+	char *p;
+
+	p = ob_need(ob, 64);
+
+	p = put_str(p, "hash xxh3 1\nbits 64\nseed 0\n", 27);
+
+	if(opts->piece)
+	{
+		p = put_str(p, "piecesize ", 10);
+		p = put_uint(p, opts->piece);
+		*p++ = '\n';
+	}
+
+	*p++ = '\n';
+
+	ob->len = p - ob->buf;
+}
+
+/* path of the first record of a file with several links, NULL if this is the first one */
+char * lm_ref(struct link_map *lm, char *fn, struct stat *statbuf)
+{
+	struct link_ent *le;
+	bool first;
+
+	if((lm == NULL) || !S_ISREG(statbuf->st_mode) || (statbuf->st_nlink < 2)) return NULL;
+
+	le = lm_find(lm, fn, statbuf, &first);
+
+	return first ? NULL : le->path;
+}
+
+/* collect a regular file for the duplicate search, empty files are left out */
+void dup_add(struct dup_set *ds, char *fn, struct stat *statbuf)
+{
+	struct dup_ent *de;
+	size_t len;
+
+	if(!S_ISREG(statbuf->st_mode) || (statbuf->st_size <= 0)) return;
+
+	len = strlen(fn);
+
+	pthread_mutex_lock(&ds->lock);
+
+	if(ds->count == ds->space)
+		if((ds->ents = realloc(ds->ents, (ds->space = ds->space ? ds->space * 2 : 1024) * sizeof(struct dup_ent))) == NULL)
+			failed("allocate duplicate candidates");
+
+	de = &ds->ents[ds->count++];
+	if((de->path = malloc(len + 1)) == NULL) failed("allocate duplicate candidates");
+	memcpy(de->path, fn, len + 1);
+	de->statbuf = *statbuf;
+	de->ok = true;
+
+	pthread_mutex_unlock(&ds->lock);
+}
+
+/* write file record, through the output window when hashing
+ * flc is the traversal that found the file, NULL for a file on the command line */
+void w_file_r(struct file_list_con *flc, char *fn, struct stat *statbuf, struct opt_struct *opts, struct out_buf *ob)
+{
+	uint64_t start;
+
+	if(file_type(statbuf, opts) == NULL) return;
+
+	start = st_begin();
+	if(ob->of->dups != NULL) dup_add(ob->of->dups, fn, statbuf);
+	else if(ob->hw != NULL) hw_file(ob, flc, fn, statbuf);
+	else w_record(fn, lm_ref(ob->of->links, fn, statbuf), statbuf, NULL, opts, ob);
+	st_end(ST_RECORD, start, false, 0);
+}
+
+/* write out all records, waiting for files being hashed */
+void ob_drain(struct out_buf *ob)
+{
+	if(ob->hw != NULL) hw_emit(ob, true);
+	ob_flush(ob);
+}
+
+/* write out and free output buffer */
+void ob_close(struct out_buf *ob)
+{
+	ob_drain(ob);
+	if(ob->hw != NULL) hw_free(ob->hw);
+	free(ob->last);
+	free(ob->ix_ents);
+	free(ob->buf);
+	free(ob);
+}
+
+/* read more input into the streaming buffer, returns false at the end of the input */
+bool mr_fill(struct man_reader *mrd)
+{
+	ssize_t n;
+
+	/* move the unfinished record to the front */
+	if(mrd->pos)
+	{
+		memmove(mrd->buf, mrd->buf + mrd->pos, mrd->len - mrd->pos);
+		mrd->len -= mrd->pos;
+		mrd->pos = 0;
+	}
+
+	/* a record larger than the buffer */
+	if(mrd->len == mrd->space)
+		if((mrd->buf = realloc(mrd->buf, mrd->space *= 2)) == NULL)
+			failed("allocate input buffer");
+
+	while((n = read(mrd->fd, mrd->buf + mrd->len, mrd->space - mrd->len)) == -1)
+		if(errno != EINTR) failed("read input manifest");
+
+	mrd->len += n;
+	if(n == 0) mrd->eof = true;
+
+	return n != 0;
+}
+
+/* read next manifest record, returns false at the end of the manifest
+ * the record points into the input and is valid until the next call */
+bool mr_read(struct man_reader *mrd, struct man_rec *mr)
+{
+	size_t len;
+	uint64_t start;
+
+	if(mrd->done) return false;
+
+	start = st_begin();
+
+	while(true)
+	{
+		/* end of the input */
+		if(mrd->eof && (mrd->pos == mrd->len))
+		{
+			mrd->done = true;
+			return false;
+		}
+
+		mr->front = mrd->front;
+
+		if((len = mr_parse(mrd->buf + mrd->pos, mrd->buf + mrd->len, mrd->eof, mr)))
+			break;
+
+		/* the record continues past the buffered input */
+		if(mrd->mapped) bad_input("truncated manifest record");
+		mr_fill(mrd);
+	}
+
+	mrd->pos += len;
+
+	/* nothing after an end record is part of the manifest */
+	if(mr->end)
+	{
+		mrd->done = true;
+		return false;
+	}
+
+	st_end(ST_READ, start, false, len);
+	return true;
+}
+
+/* open input manifest and read its header */
+struct man_reader * mr_open(int fd)
+{
+	char *p, *eol;
+	uintmax_t version;
+	struct stat st;
+	struct man_reader *mrd;
+	struct man_rec mr;
+
+	if((mrd = malloc(sizeof(struct man_reader))) == NULL) failed("allocate manifest reader");
+
+	mrd->fd = fd;
+	mrd->pos = 0;
+	mrd->eof = mrd->done = false;
+	mrd->mapped = false;
+	mrd->front = false;
+
+	/* map regular files, stream everything else */
+	if((fstat(fd, &st) == 0) && S_ISREG(st.st_mode) && (st.st_size > 0))
+	{
+		mrd->buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+		if(mrd->buf != MAP_FAILED)
+		{
+			mrd->mapped = true;
+			mrd->eof = true;
+			mrd->len = mrd->space = st.st_size;
+			posix_madvise(mrd->buf, mrd->len, POSIX_MADV_SEQUENTIAL);
+		}
+	}
+
+	if(!mrd->mapped)
+	{
+		mrd->len = 0;
+		mrd->space = IN_SIZE;
+		if((mrd->buf = malloc(mrd->space)) == NULL) failed("allocate input buffer");
+	}
+
+	/* the first record is the header */
+	mr_init(&mr, false);
+	if(!mr_read(mrd, &mr)) bad_input("invalid input file");
+
+	p = mr.type;
+	eol = mr.type + mr.type_len;
+
+	if(!is_elem(p, eol, "OUmanifest", 10)) bad_input("input is not an Opal manifest file for Unix");
+
+	if((p + 10 == eol) || (get_uint(p + 11, eol, &version) == NULL))
+		bad_input("invalid manifest version number");
+
+	if(version != 1) bad_input("unsupported manifest version number");
+
+	/* the header declares how paths are written */
+	mrd->front = mr.front_header;
+	mr_free(&mr);
+
+	return mrd;
+}
+
+/* close input manifest */
+void mr_close(struct man_reader *mrd)
+{
+	if(mrd->mapped) munmap(mrd->buf, mrd->space);
+	else free(mrd->buf);
+
+	free(mrd);
+}
+
+/* write manifest record as it was read */
+void mr_write(struct man_rec *mr, struct out_buf *ob)
+{
+	char *tail;
+
+	/* records wait their turn behind files being hashed */
+	if(ob->hw != NULL)
+	{
+		hw_copy(ob, mr);
+		return;
+	}
+
+	if(mr->path == NULL) w_copy(ob, mr->rec, mr->rec_len, NULL, 0, NULL, 0, mr->closed);
+	else
+	{
+		tail = mr->pfield + mr->pfield_len;
+		w_copy(ob, mr->rec, mr->pfield - mr->rec, mr->path, mr->path_len, tail, mr->rec + mr->rec_len - tail, mr->closed);
+	}
+}
+
+/* compare paths in canonical order: depth-first, sorted by name within each directory */
+int path_cmp(char *a, size_t a_len, char *b, size_t b_len)
+{
+	size_t i, n;
+
+	n = (a_len < b_len) ? a_len : b_len;
+
+	for(i = 0; i < n; i++)
+		if(a[i] != b[i])
+		{
+			/* a directory's files come before its siblings */
+			if(a[i] == '/') return -1;
+			if(b[i] == '/') return 1;
+			return ((unsigned char)a[i] < (unsigned char)b[i]) ? -1 : 1;
+		}
+
+	return (a_len > b_len) - (a_len < b_len);
+}
+
+/* compare command line file names in canonical order */
+int name_cmp(const void *a, const void *b)
+{
+	char *x = *(char **)a, *y = *(char **)b;
+
+	return path_cmp(x, strlen(x), y, strlen(y));
+}
+
+/* prepare the set of directories already read, only needed when following all symlinks */
+struct id_set * visited_prep(struct stat *statbuf, struct opt_struct *opts)
+{
+	struct id_set *visited;
+
+	if(!opts->all_lnk) return NULL;
+
+	visited = ids_prep();
+	ids_add(visited, statbuf->st_dev, statbuf->st_ino);
+
+	return visited;
+}
+
+/* traversal worker */
+struct worker {
+	pthread_t thread;
+	struct stat statbuf;
+	struct opt_struct *opts;
+	struct file_list_con *flc;
+	struct out_buf *ob;
+};
+
+/* traversal worker thread */
+void * tw_main(void *arg)
+{
+	struct worker *w = arg;
+
+	/* the path is only put together for files that are output */
+	while(fl_next(w->flc) != NULL)
+		if(file_type(&w->statbuf, w->opts) != NULL)
+			w_file_r(w->flc, fl_path(w->flc), &w->statbuf, w->opts, w->ob);
+
+	return NULL;
+}
+
+/* process a directory with a pool of traversal threads */
+void proc_dir_par(char *fn, struct stat *statbuf, struct opt_struct *opts, struct id_set *visited, struct out_buf *ob)
+{
+	unsigned int i;
+	struct work_pool pool;
+	struct worker *workers;
+	struct dr_pool *drp;
+
+	wp_init(&pool, opts->threads);
+	drp = drp_prep();
+
+	if((workers = malloc(opts->threads * sizeof(struct worker))) == NULL)
+		failed("allocate traversal workers");
+
+	/* seed the first worker with the top directory */
+	wp_put(&pool, 0, dr_root(drp, fn, statbuf));
+
+	/* records written so far go first */
+	ob_drain(ob);
+
+	for(i = 0; i < opts->threads; i++)
+	{
+		workers[i].opts = opts;
+		workers[i].flc = fl_prep_pool(&workers[i].statbuf, opts, visited, &pool, i, drp);
+		workers[i].ob = ob_prep(ob->of);
+		if(pthread_create(&workers[i].thread, NULL, tw_main, &workers[i]))
+			failed("create traversal thread");
+	}
+
+	for(i = 0; i < opts->threads; i++)
+	{
+		pthread_join(workers[i].thread, NULL);
+		fl_close(workers[i].flc);
+		ob_close(workers[i].ob);
+	}
+
+	free(workers);
+	wp_free(&pool);
+	drp_free(drp);
+}
+
+/* process a directory */
+void proc_dir(char *fn, struct stat *statbuf, struct opt_struct *opts, struct out_buf *ob)
+{
+	struct file_list_con *flc;
+	struct id_set *visited;
+
+	if(fn != NULL) w_file_r(NULL, fn, statbuf, opts, ob);
+
+	/* symlinks can lead to the same directory through different paths */
+	visited = visited_prep(statbuf, opts);
+
+	if((opts->threads > 1) && (!opts->canonical) && (!opts->depth_first)) proc_dir_par(fn, statbuf, opts, visited, ob);
+
+	else if((flc = fl_prep(fn, statbuf, opts, visited)) != NULL)
+	{
+		/* the path is only put together for files that are output */
+		while(fl_next(flc) != NULL)
+			if(file_type(statbuf, opts) != NULL)
+				w_file_r(flc, fl_path(flc), statbuf, opts, ob);
+
+		fl_close(flc);
+	}
+
+	if(visited != NULL) ids_free(visited);
+}
+
+/* update context */
+struct upd_con {
+	struct opt_struct *opts;
+	struct out_buf *ob;
+	struct man_reader *mrd;
+
+	/* current file record of the input manifest */
+	struct man_rec mr;
+	bool have;
+
+	/* hashes of the input manifest are out of date, or their parameters are unknown */
+	bool stale;
+
+	/* path of the previous file record */
+	bool started;
+	char *prev;
+	size_t prev_len, prev_space;
+};
+
+/* check whether a path is inside of a file hierarchy, NULL means everything */
+bool under(char *path, size_t len, char *root, size_t r_len)
+{
+	if(root == NULL) return true;
+	if((len < r_len) || memcmp(path, root, r_len)) return false;
+
+	return (len == r_len) || (path[r_len] == '/');
+}
+
+/* check whether the file type of a record is being output */
+bool rec_selected(struct man_rec *mr, struct opt_struct *opts)
+{
+	char *p, *eol;
+
+	p = mr->type + 5;
+	eol = mr->type + mr->type_len;
+
+	if(is_elem(p, eol, "regular", 7)) return opts->regular;
+	else if(is_elem(p, eol, "directory", 9)) return opts->directory;
+	else if(is_elem(p, eol, "character", 9)) return opts->chr_dev;
+	else if(is_elem(p, eol, "block", 5)) return opts->blk_dev;
+	else if(is_elem(p, eol, "symlink", 7)) return opts->symlink;
+	else if(is_elem(p, eol, "fifo", 4)) return opts->fifo;
+	else return false;
+}
+
+/* check whether a record differs from the current file status */
+bool rec_changed(struct man_rec *mr, struct stat *statbuf, struct opt_struct *opts)
+{
+	char *type;
+	size_t t_len;
+
+	/* file type */
+	type = file_type(statbuf, opts);
+	t_len = strlen(type);
+	if((mr->type_len != t_len + 5) || memcmp(mr->type + 5, type, t_len)) return true;
+
+	/* metadata that is present or requested */
+	if((mr->has_size != opts->size) || (mr->has_mtime != opts->mtime) || (mr->has_hash != opts->hash))
+		return true;
+
+	if(mr->has_phash != (opts->piece != 0)) return true;
+
+	if(opts->size && (mr->size != (uintmax_t)statbuf->st_size)) return true;
+
+	if(opts->mtime)
+		if((mr->mtime.tv_sec != statbuf->st_mtim.tv_sec) || (mr->mtime.tv_nsec != statbuf->st_mtim.tv_nsec))
+			return true;
+
+	return false;
+}
+
+/* check whether the hashes of a record still match the file,
+ * the size and modification time must be the same as when it was hashed */
+bool hash_fresh(struct man_rec *mr, struct stat *statbuf, struct opt_struct *opts)
+{
+	if(!mr->has_hmtime) return false;
+	if((mr->hmtime.tv_sec != statbuf->st_mtim.tv_sec) || (mr->hmtime.tv_nsec != statbuf->st_mtim.tv_nsec))
+		return false;
+
+	if((!mr->has_hsize) || (mr->hsize != (uintmax_t)statbuf->st_size)) return false;
+
+	/* the hashes that are output must be there */
+	if(opts->piece) return (mr->phash != NULL) && (mr->phashes == file_pieces(statbuf, opts));
+	else return mr->has_hash;
+}
+
+/* move on to the next file record of the input manifest */
+void up_next(struct upd_con *uc)
+{
+	struct man_rec *mr = &uc->mr;
+
+	while((uc->have = mr_read(uc->mrd, mr)))
+	{
+		if((mr->path != NULL) && is_elem(mr->type, mr->type + mr->type_len, "file", 4) && (mr->type_len > 5))
+			break;
+
+		/* the hash record was written with the header,
+		 * hashes made with another piece size are out of date */
+		if(hashing(uc->opts) && is_elem(mr->type, mr->type + mr->type_len, "hash", 4)
+			&& is_elem(mr->type + 5, mr->type + mr->type_len, "xxh3", 4))
+		{
+			uc->stale = (mr->has_piecesize ? mr->piecesize : 0) != uc->opts->piece;
+			continue;
+		}
+
+		/* other records are passed through */
+		mr_write(mr, uc->ob);
+	}
+
+	if(!uc->have) return;
+
+	/* the merge needs the input in canonical order */
+	if(uc->started && (path_cmp(uc->prev, uc->prev_len, mr->path, mr->path_len) >= 0))
+		bad_input("input manifest is not in canonical path order");
+
+	if(uc->prev_space < mr->path_len)
+		if((uc->prev = realloc(uc->prev, uc->prev_space = mr->path_len * 2)) == NULL)
+			failed("allocate previous path");
+	memcpy(uc->prev, mr->path, mr->path_len);
+	uc->prev_len = mr->path_len;
+	uc->started = true;
+}
+
+/* write an input record whose file is not examined */
+void up_keep(struct upd_con *uc)
+{
+	/* its hashes can't be made again with the new piece size */
+	if(hashing(uc->opts) && uc->stale && (uc->mr.has_hash || uc->mr.has_phash))
+		bad_input("input manifest has hashes made with another piece size for files that are not updated");
+
+	mr_write(&uc->mr, uc->ob);
+}
+
+/* a file of the input manifest was not found in the hierarchy */
+void up_gone(struct upd_con *uc)
+{
+	if(!(uc->opts->remove && rec_selected(&uc->mr, uc->opts))) up_keep(uc);
+
+	up_next(uc);
+}
+
+/* merge a file found in the hierarchy
+ * flc is the traversal that found the file, NULL for a file on the command line */
+void up_file(struct upd_con *uc, struct file_list_con *flc, char *fn, struct stat *statbuf)
+{
+	int c = 1;
+	size_t len;
+
+	len = strlen(fn);
+
+	/* files of the input manifest that come before it are gone */
+	while(uc->have && ((c = path_cmp(uc->mr.path, uc->mr.path_len, fn, len)) < 0)) up_gone(uc);
+
+	/* the file is in both */
+	if(uc->have && (c == 0))
+	{
+		/* hashes made with another piece size are made again, whatever the update options */
+		if(hashing(uc->opts) && uc->stale) w_file_r(flc, fn, statbuf, uc->opts, uc->ob);
+
+		else if(!uc->opts->modified) mr_write(&uc->mr, uc->ob);
+
+		/* the file changed since it was hashed */
+		else if(hashing(uc->opts) && !hash_fresh(&uc->mr, statbuf, uc->opts))
+			w_file_r(flc, fn, statbuf, uc->opts, uc->ob);
+
+		/* the hashes are still valid, the file is not read */
+		else if(rec_changed(&uc->mr, statbuf, uc->opts))
+		{
+			if(hashing(uc->opts)) hw_kept(uc->ob, fn, statbuf, &uc->mr);
+			else w_file_r(flc, fn, statbuf, uc->opts, uc->ob);
+		}
+
+		/* other links of the file refer to this record */
+		else if(S_ISREG(statbuf->st_mode) && (statbuf->st_nlink > 1) && (uc->ob->of->links != NULL))
+		{
+			if(hashing(uc->opts)) hw_kept(uc->ob, fn, statbuf, &uc->mr);
+			else
+			{
+				lm_ref(uc->ob->of->links, fn, statbuf);
+				mr_write(&uc->mr, uc->ob);
+			}
+		}
+
+		else mr_write(&uc->mr, uc->ob);
+
+		up_next(uc);
+	}
+
+	/* the file is new */
+	else if(uc->opts->add) w_file_r(flc, fn, statbuf, uc->opts, uc->ob);
+}
+
+/* merge the files of a directory */
+void up_dir(struct upd_con *uc, char *fn, struct stat *statbuf)
+{
+	struct file_list_con *flc;
+	struct id_set *visited;
+
+	visited = visited_prep(statbuf, uc->opts);
+
+	if((flc = fl_prep(fn, statbuf, uc->opts, visited)) != NULL)
+	{
+		while(fl_next(flc) != NULL)
+			if(file_type(statbuf, uc->opts) != NULL)
+				up_file(uc, flc, fl_path(flc), statbuf);
+
+		fl_close(flc);
+	}
+
+	if(visited != NULL) ids_free(visited);
+}
+
+/* update an existing manifest file
+ * the input manifest and the hierarchy are merged in canonical path order */
+void update_manifest(char **fnames, struct opt_struct *opts)
+{
+	int i;
+	char *fn;
+	size_t len;
+	struct stat statbuf;
+	struct upd_con uc;
+	struct out_file of;
+
+	/* traverse the hierarchy in the order of the input */
+	opts->canonical = true;
+	opts->depth_first = false;
+	for(i = 0; fnames[i] != NULL; i++);
+	qsort(fnames, i, sizeof(char *), name_cmp);
+
+	of.fd = STDOUT_FILENO;
+	of.pos = 0;
+	if(pthread_mutex_init(&of.lock, NULL)) failed("initialize output lock");
+	of.hp = hashing(opts) ? hp_prep(opts) : NULL;
+	of.links = (opts->links || hashing(opts)) ? lm_prep() : NULL;
+	of.dups = NULL;
+	of.index = (opts->index_fn != NULL) ? ix_prep(opts->index_fn) : NULL;
+	of.front = opts->front;
+
+	uc.opts = opts;
+	uc.ob = ob_prep(&of);
+	uc.stale = true;
+	uc.started = false;
+	uc.prev = NULL;
+	uc.prev_len = uc.prev_space = 0;
+	mr_init(&uc.mr, false);
+
+	/* read header of input file */
+	uc.mrd = mr_open(STDIN_FILENO);
+
+	/* write header */
+	w_header(uc.ob);
+	if(hashing(opts)) w_hash_r(opts, uc.ob);
+
+	up_next(&uc);
+
+	/* process filenames on the command line */
+	for(i = 0; (fn = fnames[i]) != NULL; i++)
+	{
+		len = strlen(fn);
+
+		/* records before this file are not part of the update */
+		while(uc.have && (path_cmp(uc.mr.path, uc.mr.path_len, fn, len) < 0))
+		{
+			up_keep(&uc);
+			up_next(&uc);
+		}
+
+		/* merge the file and its hierarchy */
+		if(!get_stat(opts->cmd_lnk, AT_FDCWD, fn, &statbuf, stat_fields(opts), true))
+		{
+			if(file_type(&statbuf, opts) != NULL) up_file(&uc, NULL, fn, &statbuf);
+			if(S_ISDIR(statbuf.st_mode)) up_dir(&uc, fn, &statbuf);
+		}
+
+		/* whatever is left under it is gone */
+		while(uc.have && under(uc.mr.path, uc.mr.path_len, fn, len)) up_gone(&uc);
+	}
+
+	/* if no files are listed on the command line, merge the pwd */
+	if(i == 0)
+	{
+		/* get pwd metadata */
+		if(stat(".", &statbuf) == -1)
+		{perror("."); exit(EXIT_FAILURE);}
+
+		up_dir(&uc, NULL, &statbuf);
+
+		while(uc.have) up_gone(&uc);
+	}
+
+	/* records after the last file are not part of the update */
+	while(uc.have)
+	{
+		up_keep(&uc);
+		up_next(&uc);
+	}
+
+	mr_close(uc.mrd);
+	mr_free(&uc.mr);
+	ob_close(uc.ob);
+	if(of.index != NULL) ix_write(of.index, of.pos);
+	if(of.hp != NULL) hp_free(of.hp);
+	if(of.links != NULL) lm_free(of.links);
+	pthread_mutex_destroy(&of.lock);
+	free(uc.prev);
+}
+
+/* compare records being sorted, those without a path go first */
+int sort_key(struct sort_rec *a, struct sort_rec *b)
+{
+	if(!(a->len.has_path && b->len.has_path)) return (int)a->len.has_path - (int)b->len.has_path;
+
+	return path_cmp(a->data + a->len.head, a->len.path, b->data + b->len.head, b->len.path);
+}
+
+/* records with the same key keep the order of the input, as their bytes do */
+int sort_cmp(const void *a, const void *b)
+{
+	struct sort_rec *ra = (struct sort_rec *)a, *rb = (struct sort_rec *)b;
+	int c;
+
+	if((c = sort_key(ra, rb))) return c;
+
+	return (ra->data > rb->data) - (ra->data < rb->data);
+}
+
+/* output a sorted record */
+void sort_out(struct sort_rec *sr, struct out_buf *ob)
+{
+	char *d = sr->data;
+
+	if(sr->len.has_path)
+		w_copy(ob, d, sr->len.head, d + sr->len.head, sr->len.path, d + sr->len.head + sr->len.path, sr->len.tail, sr->len.closed);
+	else w_copy(ob, d, sr->len.head, NULL, 0, NULL, 0, sr->len.closed);
+}
+
+/* write the buffer to the temporary file */
+void sort_flush(struct sort_con *sc)
+{
+	size_t done;
+	ssize_t n;
+
+	for(done = 0; done < sc->wlen; done += n)
+		if((n = write(fileno(sc->tmp), sc->wbuf + done, sc->wlen - done)) == -1)
+		{
+			if(errno == EINTR) n = 0;
+			else failed("write sorted run to the temporary file");
+		}
+
+	sc->end += sc->wlen;
+	sc->wlen = 0;
+}
+
+/* add bytes to a sorted run */
+void sort_put(struct sort_con *sc, void *p, size_t len)
+{
+	size_t n;
+
+	while(len)
+	{
+		if(sc->wlen == OUT_SIZE) sort_flush(sc);
+
+		n = (len < OUT_SIZE - sc->wlen) ? len : OUT_SIZE - sc->wlen;
+		memcpy(sc->wbuf + sc->wlen, p, n);
+		sc->wlen += n;
+		p = (char *)p + n;
+		len -= n;
+	}
+}
+
+/* sort the records held in memory and write them to the temporary file as a run */
+void sort_spill(struct sort_con *sc)
+{
+	size_t i;
+	struct sort_rec *sr;
+	struct sort_run *run;
+
+	if(sc->tmp == NULL)
+	{
+		if((sc->tmp = tmpfile()) == NULL) failed("create temporary file");
+		if((sc->wbuf = malloc(OUT_SIZE)) == NULL) failed("allocate sort buffer");
+	}
+
+	if(sc->r_count == sc->runs_space)
+		if((sc->runs = realloc(sc->runs, (sc->runs_space = 2 * sc->runs_space + 16) * sizeof(struct sort_run))) == NULL)
+			failed("allocate sorted runs");
+
+	qsort(sc->recs, sc->count, sizeof(struct sort_rec), sort_cmp);
+
+	run = sc->runs + sc->r_count++;
+	run->pos = sc->end + sc->wlen;
+
+	for(i = 0; i < sc->count; i++)
+	{
+		sr = sc->recs + i;
+		sort_put(sc, &sr->len, sizeof(struct sort_len));
+		sort_put(sc, sr->data, sr->len.head + sr->len.path + sr->len.tail);
+	}
+
+	sort_flush(sc);
+	run->end = sc->end;
+
+	sc->count = 0;
+	sc->used = 0;
+}
+
+/* hold a record of the input manifest, the held records go to a run once there are too many */
+void sort_add(struct sort_con *sc, struct man_rec *mr)
+{
+	struct sort_len len;
+	struct sort_rec *sr;
+	size_t size;
+	char *tail;
+
+	len.closed = mr->closed;
+
+	if((len.has_path = (mr->path != NULL)))
+	{
+		tail = mr->pfield + mr->pfield_len;
+		len.head = mr->pfield - mr->rec;
+		len.path = mr->path_len;
+		len.tail = mr->rec + mr->rec_len - tail;
+	}
+	else
+	{
+		tail = NULL;
+		len.head = mr->rec_len;
+		len.path = len.tail = 0;
+	}
+
+	size = len.head + len.path + len.tail;
+
+	if(sc->count && (sc->used + size + (sc->count + 1) * sizeof(struct sort_rec) > SORT_RUN)) sort_spill(sc);
+
+	/* a single record larger than the memory bound */
+	if(size > sc->d_space)
+		if((sc->data = realloc(sc->data, sc->d_space = size)) == NULL) failed("allocate sort buffer");
+
+	if(sc->count == sc->r_space)
+		if((sc->recs = realloc(sc->recs, (sc->r_space = 2 * sc->r_space + 1024) * sizeof(struct sort_rec))) == NULL)
+			failed("allocate sort buffer");
+
+	sr = sc->recs + sc->count++;
+	sr->data = sc->data + sc->used;
+	sr->len = len;
+
+	memcpy(sr->data, mr->rec, len.head);
+	if(len.has_path)
+	{
+		memcpy(sr->data + len.head, mr->path, len.path);
+		memcpy(sr->data + len.head + len.path, tail, len.tail);
+	}
+
+	sc->used += size;
+}
+
+/* have at least n bytes of a sorted run in its buffer */
+void sort_fill(struct sort_con *sc, struct sort_run *run, size_t n)
+{
+	ssize_t got;
+	size_t want;
+
+	if(run->len - run->at >= n) return;
 
-	/* if traversing the filesystem physically */
-	else
+	memmove(run->buf, run->buf + run->at, run->len - run->at);
+	run->len -= run->at;
+	run->at = 0;
+
+	/* a single record larger than the buffer */
+	if(run->space < n)
+		if((run->buf = realloc(run->buf, run->space = n)) == NULL) failed("allocate sort buffer");
+
+	while(run->len < n)
 	{
-		/* get physical file status */
-		if(lstat(fn, statbuf) == -1)
+		if(run->pos == run->end) failed("read sorted run from the temporary file");
+
+		want = run->space - run->len;
+		if((off_t)want > run->end - run->pos) want = run->end - run->pos;
+
+		if((got = pread(fileno(sc->tmp), run->buf + run->len, want, run->pos)) <= 0)
 		{
-			if(verbose) perror(fn);
-			return -1;
+			if((got == -1) && (errno == EINTR)) continue;
+			failed("read sorted run from the temporary file");
 		}
-		else return 0;
+
+		run->len += got;
+		run->pos += got;
 	}
 }
 
-/* read header of an input manifest file */
-void read_header(void)
+/* go to the next record of a sorted run */
+void sort_next(struct sort_con *sc, struct sort_run *run)
 {
-	char *line = NULL, *token, delim[] = " \n";
-	size_t len = 0;
-	int version = 0, c, prev = '\n';
+	struct sort_len len;
+	size_t size;
 
-	if(getline(&line, &len, stdin) == -1)
+	if((run->at == run->len) && (run->pos == run->end))
 	{
-		fputs("invalid input file\n", stderr);
-		exit(EXIT_FAILURE);
+		run->cur.data = NULL;
+		return;
 	}
 
-	token = strtok(line, delim);
+	sort_fill(sc, run, sizeof(struct sort_len));
+	memcpy(&len, run->buf + run->at, sizeof(struct sort_len));
 
-	if((token == NULL) || strcmp(token, "OUmanifest"))
-	{
-		fputs("input is not an Opal manifest file for Unix\n", stderr);
-		exit(EXIT_FAILURE);
-	}
+	size = sizeof(struct sort_len) + len.head + len.path + len.tail;
+	sort_fill(sc, run, size);
+
+	run->cur.data = run->buf + run->at + sizeof(struct sort_len);
+	run->cur.len = len;
+	run->at += size;
+}
+
+/* whether the record of run a goes before the record of run b, a run that is done goes last
+ * records with the same key keep the order of the input, as the runs do */
+bool sort_less(struct sort_run *runs, size_t a, size_t b)
+{
+	int c;
 
-	token = strtok(NULL, delim);
+	if(runs[a].cur.data == NULL) return false;
+	if(runs[b].cur.data == NULL) return true;
 
-	if((token == NULL) || (sscanf(token, "%d", &version) != 1))
+	c = sort_key(&runs[a].cur, &runs[b].cur);
+
+	return (c < 0) || ((c == 0) && (a < b));
+}
+
+/* fill in the loser tree under a node, returns the winner
+ * node i has children 2i and 2i + 1, and the k runs are the leaves k to 2k - 1 */
+size_t sort_build(struct sort_run *runs, size_t *tree, size_t k, size_t node)
+{
+	size_t l, r;
+
+	if(node >= k) return node - k;
+
+	l = sort_build(runs, tree, k, 2 * node);
+	r = sort_build(runs, tree, k, 2 * node + 1);
+
+	if(sort_less(runs, r, l))
 	{
-		fputs("invalid manifest version number\n", stderr);
-		exit(EXIT_FAILURE);
+		tree[node] = l;
+		return r;
 	}
 
-	if(version != 1)
+	tree[node] = r;
+	return l;
+}
+
+/* merge the sorted runs through a loser tree, the winner is at its root */
+void sort_merge(struct sort_con *sc, struct out_buf *ob)
+{
+	size_t i, k = sc->r_count, space, *tree, w, n, t;
+	struct sort_run *run;
+
+	/* the read buffers share the memory bound */
+	space = SORT_RUN / k;
+	if(space < SORT_READ) space = SORT_READ;
+
+	for(i = 0; i < k; i++)
 	{
-		fputs("unsupported manifest version number\n", stderr);
-		exit(EXIT_FAILURE);
+		run = sc->runs + i;
+		if((run->buf = malloc(run->space = space)) == NULL) failed("allocate sort buffer");
+		run->len = run->at = 0;
+		sort_next(sc, run);
 	}
 
-	while((c = getchar()) != EOF)
+	if((tree = malloc(k * sizeof(size_t))) == NULL) failed("allocate loser tree");
+	tree[0] = sort_build(sc->runs, tree, k, 1);
+
+	while(sc->runs[w = tree[0]].cur.data != NULL)
 	{
-		if((c == '\n') && (prev == '\n')) break;
-		prev = c;
+		sort_out(&sc->runs[w].cur, ob);
+		sort_next(sc, sc->runs + w);
+
+		/* the next record of the run plays the losers on the way up */
+		for(n = (w + k) / 2; n > 0; n /= 2)
+			if(sort_less(sc->runs, tree[n], w))
+			{
+				t = tree[n];
+				tree[n] = w;
+				w = t;
+			}
+
+		tree[0] = w;
 	}
 
-	free(line);
+	for(i = 0; i < k; i++) free(sc->runs[i].buf);
+	free(tree);
 }
 
-/* add directory record */
-void dr_add(struct file_list_con *flc)
+/* sort the manifest on standard input into canonical order */
+void sort_manifest(struct opt_struct *opts)
 {
 	size_t i;
-	struct dir_rec *c_dir, *l_dir;
+	struct sort_con sc;
+	struct man_reader *mrd;
+	struct man_rec mr;
+	struct out_file of;
+	struct out_buf *ob;
+
+	of.fd = STDOUT_FILENO;
+	of.pos = 0;
+	if(pthread_mutex_init(&of.lock, NULL)) failed("initialize output lock");
+	of.hp = NULL;
+	of.links = NULL;
+	of.dups = NULL;
+	of.index = (opts->index_fn != NULL) ? ix_prep(opts->index_fn) : NULL;
+	of.front = opts->front;
+	ob = ob_prep(&of);
+
+	sc.recs = NULL;
+	sc.count = sc.r_space = 0;
+	sc.used = 0;
+	if((sc.data = malloc(sc.d_space = SORT_RUN)) == NULL) failed("allocate sort buffer");
+	sc.tmp = NULL;
+	sc.end = 0;
+	sc.wbuf = NULL;
+	sc.wlen = 0;
+	sc.runs = NULL;
+	sc.r_count = sc.runs_space = 0;
 
-	c_dir = flc->c_dir;
-	l_dir = flc->l_dir;
+	/* read header of input file */
+	mr_init(&mr, false);
+	mrd = mr_open(STDIN_FILENO);
 
-	/* check for infinite directory loop */
-	for(i = 0; i < c_dir->ino_count; i++)
-		if(flc->statbuf->st_ino == c_dir->ino_list[i])
-			if(flc->statbuf->st_dev == c_dir->dev_list[i])
-				fail("infinite directory loop");
+	w_header(ob);
 
-	/* allocate new directory record */
-	if((l_dir->next = malloc(sizeof(struct dir_rec))) == NULL) failed("allocate directory record");
-	flc->l_dir = l_dir = l_dir->next;
-
-	/* new directory path */
-	if((l_dir->path = malloc(strlen(flc->f_path) + 1)) == NULL) failed("allocate directory path");
-	strcpy(l_dir->path, flc->f_path);
-
-	/* new inode number list */
-	l_dir->ino_count = c_dir->ino_count + 1;
-	if((l_dir->ino_list = malloc(l_dir->ino_count * sizeof(ino_t))) == NULL)
-		failed("allocate inode number list");
-	for(i = 0; i < c_dir->ino_count; i++)
-		l_dir->ino_list[i] = c_dir->ino_list[i];
-	l_dir->ino_list[c_dir->ino_count] = flc->statbuf->st_ino;
-
-	/* new device number list */
-	if((l_dir->dev_list = malloc(l_dir->ino_count * sizeof(dev_t))) == NULL)
-		failed("allocate device number list");
-	for(i = 0; i < c_dir->ino_count; i++)
-		l_dir->dev_list[i] = c_dir->dev_list[i];
-	l_dir->dev_list[c_dir->ino_count] = flc->statbuf->st_dev;
+	while(mr_read(mrd, &mr)) sort_add(&sc, &mr);
 
-	/* terminate linked list */
-	l_dir->next = NULL;
-}
+	mr_close(mrd);
+	mr_free(&mr);
 
-/* get next directory record */
-struct dir_rec * dr_next(struct dir_rec *c_dir)
-{
-	struct dir_rec *n_dir;
+	/* a manifest that fits in memory doesn't need the temporary file */
+	if(sc.tmp == NULL)
+	{
+		if(sc.count > 1) qsort(sc.recs, sc.count, sizeof(struct sort_rec), sort_cmp);
+		for(i = 0; i < sc.count; i++) sort_out(sc.recs + i, ob);
+	}
+	else
+	{
+		if(sc.count) sort_spill(&sc);
 
-	n_dir = c_dir->next;
-	free(c_dir->path);
-	free(c_dir->ino_list);
-	free(c_dir->dev_list);
-	free(c_dir);
+		free(sc.data);
+		free(sc.recs);
+		sc.data = NULL;
+		sc.recs = NULL;
 
-	return n_dir;
-}
+		sort_merge(&sc, ob);
 
-/* prepare file list */
-struct file_list_con * fl_prep(char *root, struct stat *statbuf, struct opt_struct *opts)
-{
-	struct file_list_con *flc;
-	struct dir_rec *f_dir;
+		fclose(sc.tmp);
+		free(sc.wbuf);
+		free(sc.runs);
+	}
 
-	/* allocate new file list context */
-	if((flc = malloc(sizeof(struct file_list_con))) == NULL) failed("allocate file list context");
+	free(sc.data);
+	free(sc.recs);
 
-	flc->verbose = opts->verbose;
-	flc->follow_link = opts->all_lnk;
-	flc->statbuf = statbuf;
-	flc->space = 0;
-	flc->f_path = NULL;
+	ob_close(ob);
+	if(of.index != NULL) ix_write(of.index, of.pos);
+	pthread_mutex_destroy(&of.lock);
+}
+
+/* hash the head and the tail of an open file, a small file is hashed whole */
+bool dup_sample(int fd, char *fn, uintmax_t size, unsigned char *buf, uint64_t *value, bool verbose)
+{
+	ssize_t n;
+	size_t got, want;
+	struct xxh3 st;
 
-	/* allocate first directory record */
-	if((f_dir = malloc(sizeof(struct dir_rec))) == NULL) failed("allocate first directory record");
-	flc->l_dir = flc->c_dir = f_dir;
+	if(size <= 2 * DUP_SAMPLE) return hash_file(fd, fn, buf, value, verbose);
 
-	if(root != NULL)
+	/* the head and the tail go next to each other in the buffer */
+	for(got = 0; got < 2 * DUP_SAMPLE; got += n)
 	{
-		flc->pre_len = strlen(root);
+		want = (got < DUP_SAMPLE) ? DUP_SAMPLE : 2 * DUP_SAMPLE;
 
-		/* store directory name */
-		if((f_dir->path = malloc(flc->pre_len + 1)) == NULL) failed("allocate first directory path");
-		strcpy(f_dir->path, root);
-
-		/* open directory */
-		if((flc->dp = opendir(root)) == NULL)
+		if((n = pread(fd, buf + got, want - got, (got < DUP_SAMPLE) ? got : size - 2 * DUP_SAMPLE + got)) == -1)
 		{
-			perror(f_dir->path);
-			free(f_dir->path);
-			free(f_dir);
-			free(flc);
-			return NULL;
+			if(errno == EINTR) {n = 0; continue;}
+			if(verbose) perror(fn);
+			return false;
 		}
-	}
-	else
-	{
-		f_dir->path = NULL;
-		flc->pre_len = 0;
 
-		/* open directory */
-		if((flc->dp = opendir(".")) == NULL)
+		if(n == 0)
 		{
-			perror(f_dir->path);
-			free(f_dir->path);
-			free(f_dir);
-			free(flc);
-			return NULL;
+			if(verbose) fprintf(stderr, "%s: file changed while hashing\n", fn);
+			return false;
 		}
 	}
 
-	f_dir->ino_count = 1;
-
-	/* create first inode number list */
-	if((f_dir->ino_list = malloc(sizeof(ino_t))) == NULL)
-		failed("allocate first inode number list");
-	f_dir->ino_list[0] = statbuf->st_ino;
-
-	/* create first device number list */
-	if((f_dir->dev_list = malloc(sizeof(dev_t))) == NULL)
-		failed("allocate first device number list");
-	f_dir->dev_list[0] = statbuf->st_dev;
+	xh_init(&st);
+	xh_update(&st, buf, 2 * DUP_SAMPLE);
+	*value = xh_final(&st);
 
-	/* terminate linked list */
-	f_dir->next = NULL;
-
-	return flc;
+	return true;
 }
 
-/* next file in list */
-char * fl_next(struct file_list_con *flc)
+/* duplicate search thread, hashes the samples or the whole data of the candidates */
+void * dup_main(void *arg)
 {
-	size_t com_len;
-	struct dirent *dir_e;
+	struct dup_set *ds = arg;
+	struct dup_ent *de;
+	struct hc_slot key;
+	unsigned char *buf;
+	size_t i;
+	uintmax_t size;
+	int fd;
 
-	if(flc->c_dir == NULL) return NULL;
+	if((buf = aligned_alloc(HASH_ALIGN, HASH_BUF)) == NULL) failed("allocate hash buffer");
 
-	/* loop until a good path is found */
-	while(true)
+	while((i = atomic_fetch_add(&ds->next, 1)) < ds->count)
 	{
-		/* get the next file in the directory */
-		if((dir_e = readdir(flc->dp)) != NULL)
-		{
-			/* ignore the current and parent directories */
-			if((!strcmp(dir_e->d_name, ".")) || (!strcmp(dir_e->d_name, ".."))) continue;
-
-			/* allocate space for the file path */
-			com_len = flc->pre_len + strlen(dir_e->d_name) + 2;
-			if(flc->space < com_len)
-				if((flc->f_path = realloc(flc->f_path, flc->space = com_len)) == NULL)
-					failed("allocate file path");
+		de = &ds->ents[i];
+		size = de->statbuf.st_size;
 
-			/* put together path */
-			if(flc->c_dir->path != NULL) sprintf(flc->f_path, "%s/%s", flc->c_dir->path, dir_e->d_name);
-			else strcpy(flc->f_path, dir_e->d_name);
-
-			if(get_stat(flc->follow_link, flc->f_path, flc->statbuf, flc->verbose)) continue;
-			else break;
+		/* the directories were closed after the traversal, the sample and the hash must come from the file that was found */
+		if(!ds->full)
+		{
+			if((fd = hash_open(AT_FDCWD, de->path, de->path, &de->statbuf, ds->opts->verbose)) == -1) de->ok = false;
+			else
+			{
+				de->ok = dup_sample(fd, de->path, size, buf, &de->sample, ds->opts->verbose);
+				close(fd);
+			}
 		}
 
-		/* if the end of the directory has been reached */
+		/* the sample of a small file is its whole data */
+		else if(size <= 2 * DUP_SAMPLE) de->hash = de->sample;
+
 		else
 		{
-			/* close current directory */
-			closedir(flc->dp);
-			flc->dp = NULL;
+			if(ds->cache != NULL) hc_key(ds->cache, &key, &de->statbuf, 0, 0);
 
-			/* open next directory */
-			while(true)
+			/* an earlier run might have hashed it already */
+			if((ds->cache != NULL) && hc_get(ds->cache, &key, &de->hash)) continue;
+
+			if((fd = hash_open(AT_FDCWD, de->path, de->path, &de->statbuf, ds->opts->verbose)) == -1)
 			{
-				/* if no more directories, return NULL */
-				if((flc->c_dir = dr_next(flc->c_dir)) == NULL)
-					return NULL;
+				de->ok = false;
+				continue;
+			}
 
-				if((flc->dp = opendir(flc->c_dir->path)) == NULL)
-				{if(flc->verbose) perror(flc->c_dir->path);}
+			de->ok = hash_file(fd, de->path, buf, &de->hash, ds->opts->verbose);
 
-				else
-				{
-					flc->pre_len = strlen(flc->c_dir->path);
-					break;
-				}
+			if(de->ok && (ds->cache != NULL) && file_same(fd, &de->statbuf))
+			{
+				key.hash = de->hash;
+				hc_add(ds->cache, &key);
 			}
+
+			close(fd);
 		}
 	}
 
-	/* if directory, add to list of directories to process */
-	if(S_ISDIR(flc->statbuf->st_mode)) dr_add(flc);
+	free(buf);
 
-	return flc->f_path;
+	return NULL;
 }
 
-/* close file list */
-void fl_close(struct file_list_con *flc)
+/* hash all candidates on a pool of threads */
+void dup_run(struct dup_set *ds, bool full)
 {
-	if(flc->dp != NULL) closedir(flc->dp);
-
-	while(flc->c_dir != NULL) flc->c_dir = dr_next(flc->c_dir);
-
-	free(flc->f_path);
-	free(flc);
-}
+	unsigned int i;
+	pthread_t *threads;
 
-/* prepare hierarchy cache */
-struct h_cache * hc_prep(bool follow_link, bool verbose)
-{
-	struct h_cache *hc;
+	ds->full = full;
+	atomic_store(&ds->next, 0);
 
-	hc = malloc(sizeof(struct h_cache));
+	if((threads = malloc(ds->opts->threads * sizeof(pthread_t))) == NULL)
+		failed("allocate hashing threads");
 
-	hc->follow_link = follow_link;
-	hc->verbose = verbose;
+	for(i = 0; i < ds->opts->threads; i++)
+		if(pthread_create(&threads[i], NULL, dup_main, ds))
+			failed("create hashing thread");
 
-	hc->cache = NULL;
-	hc->count = 0;
+	for(i = 0; i < ds->opts->threads; i++) pthread_join(threads[i], NULL);
 
-	return hc;
+	free(threads);
 }
 
-void hc_add(struct h_cache *hc, char *fn, struct stat *statbuf)
+/* compare candidates by size, larger first */
+int dup_size_cmp(const void *a, const void *b)
 {
-	DIR *dp;
+	const struct dup_ent *x = a, *y = b;
 
-	if((dp = opendir(fn)) == NULL)
-	{perror(fn); return;}
+	if(x->statbuf.st_size != y->statbuf.st_size) return (x->statbuf.st_size > y->statbuf.st_size) ? -1 : 1;
+	return 0;
+}
 
-	if((hc->cache = realloc(hc->cache, ++hc->count * sizeof(struct node_record))) == NULL)
-		failed("allocate root node record");
+/* compare candidates by size and identity, the links of a file in canonical path order */
+int dup_id_cmp(const void *a, const void *b)
+{
+	const struct dup_ent *x = a, *y = b;
+	int c;
 
-	closedir(dp);
+	if((c = dup_size_cmp(a, b))) return c;
+	if(x->statbuf.st_dev != y->statbuf.st_dev) return (x->statbuf.st_dev < y->statbuf.st_dev) ? -1 : 1;
+	if(x->statbuf.st_ino != y->statbuf.st_ino) return (x->statbuf.st_ino < y->statbuf.st_ino) ? -1 : 1;
+	return path_cmp(x->path, strlen(x->path), y->path, strlen(y->path));
 }
 
-/* write file record */
-void w_file_r(char *fn, struct stat *statbuf, struct opt_struct *opts)
+/* compare candidates by size and sample hash */
+int dup_sample_cmp(const void *a, const void *b)
 {
-	char *type;
-
-	/* determine file type */
-	if(opts->regular && S_ISREG(statbuf->st_mode)) type = "regular";
-	else if(opts->directory && S_ISDIR(statbuf->st_mode)) type = "directory";
-	else if(opts->chr_dev && S_ISCHR(statbuf->st_mode)) type = "character";
-	else if(opts->blk_dev && S_ISBLK(statbuf->st_mode)) type = "block";
-	else if(opts->symlink && S_ISLNK(statbuf->st_mode)) type = "symlink";
-	else if(opts->fifo && S_ISFIFO(statbuf->st_mode)) type = "fifo";
-	else return;
+	const struct dup_ent *x = a, *y = b;
+	int c;
 
-	/* write file type indicator */
-	if(printf("file %s\n", type) < 0)
-		failed("write file record header");
+	if((c = dup_size_cmp(a, b))) return c;
+	if(x->sample != y->sample) return (x->sample < y->sample) ? -1 : 1;
+	return 0;
+}
 
-	/* write file path */
-	if(printf("data %zu path\n%s\n", strlen(fn), fn) < 0) failed("write path field");
+/* compare candidates by size and hash */
+int dup_hash_cmp(const void *a, const void *b)
+{
+	const struct dup_ent *x = a, *y = b;
+	int c;
 
-	/* write file size */
-	if(opts->size)
-		if(printf("size %ju\n", (uintmax_t)statbuf->st_size) < 0)
-			failed("write size field");
+	if((c = dup_size_cmp(a, b))) return c;
+	if(x->hash != y->hash) return (x->hash < y->hash) ? -1 : 1;
+	return 0;
+}
 
-	/* write modification time */
-	if(opts->mtime)
-		if(printf("mtime %ju %ld\n", (uintmax_t)statbuf->st_mtim.tv_sec, statbuf->st_mtim.tv_nsec) < 0)
-			failed("write mtime field");
+/* compare candidates in output order, the paths of a set in canonical order */
+int dup_out_cmp(const void *a, const void *b)
+{
+	const struct dup_ent *x = a, *y = b;
+	int c;
 
-	/* end file record */
-	if(putchar('\n') == EOF) failed("terminate file record");
+	if((c = dup_hash_cmp(a, b))) return c;
+	return path_cmp(x->path, strlen(x->path), y->path, strlen(y->path));
 }
 
-/* process a directory */
-void proc_dir(char *fn, struct stat *statbuf, struct opt_struct *opts)
+/* keep the runs of at least two sorted candidates that compare equal,
+ * candidates that could not be read are dropped first */
+void dup_keep(struct dup_set *ds, int (*same)(const void *, const void *))
 {
-	struct file_list_con *flc;
+	size_t i, j, n, kept;
 
-	if(fn != NULL) w_file_r(fn, statbuf, opts);
+	for(i = n = 0; i < ds->count; i++)
+		if(ds->ents[i].ok) ds->ents[n++] = ds->ents[i];
+		else free(ds->ents[i].path);
 
-	if((flc = fl_prep(fn, statbuf, opts)) == NULL) return;
+	for(i = kept = 0; i < n; i = j)
+	{
+		for(j = i + 1; (j < n) && !same(&ds->ents[i], &ds->ents[j]); j++);
 
-	while((fn = fl_next(flc)) != NULL) w_file_r(fn, statbuf, opts);
+		if(j - i > 1)
+		{
+			memmove(&ds->ents[kept], &ds->ents[i], (j - i) * sizeof(struct dup_ent));
+			kept += j - i;
+		}
+		else free(ds->ents[i].path);
+	}
 
-	fl_close(flc);
+	ds->count = kept;
 }
 
-/* update an existing manifest file */
-void update_manifest(char **fnames, struct opt_struct *opts)
+/* find files with the same data and output them as sets of consecutive records */
+void find_dups(char **fnames, struct opt_struct *opts)
 {
 	int i;
+	size_t j, n, files;
 	char *fn;
-	struct h_cache *hc;
-	struct l_cache *lc;
 	struct stat statbuf;
-	struct man_rec mr;
+	struct out_file of;
+	struct out_buf *ob;
+	struct dup_set ds;
+	struct hash_res hr;
+
+	/* whole file hashes of regular files are output with their sizes */
+	opts->regular = opts->size = opts->hash = true;
+	opts->piece = 0;
+
+	of.fd = STDOUT_FILENO;
+	of.pos = 0;
+	if(pthread_mutex_init(&of.lock, NULL)) failed("initialize output lock");
+	of.hp = NULL;
+	of.links = NULL;
+	of.dups = &ds;
+	of.index = (opts->index_fn != NULL) ? ix_prep(opts->index_fn) : NULL;
+	of.front = opts->front;
+
+	if(pthread_mutex_init(&ds.lock, NULL)) failed("initialize duplicate search lock");
+	ds.ents = NULL;
+	ds.count = ds.space = 0;
+	ds.opts = opts;
+	ds.cache = NULL;
+
+	ob = ob_prep(&of);
+
+	/* collect the files, nothing is output yet */
+	for(i = 0; (fn = fnames[i]) != NULL; i++)
+	{
+		if(get_stat(opts->cmd_lnk, AT_FDCWD, fn, &statbuf, stat_fields(opts), true)) continue;
 
-	/* read header of input file */
-	read_header();
+		if(S_ISDIR(statbuf.st_mode)) proc_dir(fn, &statbuf, opts, ob);
+		else w_file_r(NULL, fn, &statbuf, opts, ob);
+	}
 
-	/* if adding records, prepare hierarchy cache */
-	if(opts->add)
+	if(i == 0)
 	{
-		hc = hc_prep(opts->all_lnk, opts->verbose);
+		if(stat(".", &statbuf) == -1)
+		{perror("."); exit(EXIT_FAILURE);}
 
-		for(i = 0; (fn = fnames[i]) != NULL; i++)
-		{
-			if(get_stat(opts->cmd_lnk, fn, &statbuf, true)) continue;
-			hc_add(hc, fn, &statbuf);
-		}
+		proc_dir(NULL, &statbuf, opts, ob);
 	}
 
+	files = ds.count;
+
+	/* only files with the same size can be duplicates,
+	 * other links to a file are the same data, not a copy of it */
+	qsort(ds.ents, ds.count, sizeof(struct dup_ent), dup_id_cmp);
+
+	for(j = n = 0; j < ds.count; j++)
+		if(n && (ds.ents[n - 1].statbuf.st_ino == ds.ents[j].statbuf.st_ino)
+			&& (ds.ents[n - 1].statbuf.st_dev == ds.ents[j].statbuf.st_dev))
+			free(ds.ents[j].path);
+		else ds.ents[n++] = ds.ents[j];
+	ds.count = n;
+
+	dup_keep(&ds, dup_size_cmp);
+	if(opts->verbose) fprintf(stderr, "%zu files, %zu with the size of another\n", files, ds.count);
+
+	/* compare samples from the head and tail of each file */
+	dup_run(&ds, false);
+	qsort(ds.ents, ds.count, sizeof(struct dup_ent), dup_sample_cmp);
+	dup_keep(&ds, dup_sample_cmp);
+	if(opts->verbose) fprintf(stderr, "%zu with the same samples as another\n", ds.count);
+
+	/* only the files that still match are read whole */
+	if(opts->cache_fn != NULL) ds.cache = hc_open(opts->cache_fn, opts->verbose);
+	dup_run(&ds, true);
+	if(ds.cache != NULL) hc_close(ds.cache);
+
+	qsort(ds.ents, ds.count, sizeof(struct dup_ent), dup_out_cmp);
+	dup_keep(&ds, dup_hash_cmp);
+	if(opts->verbose) fprintf(stderr, "%zu with the same data as another\n", ds.count);
+
 	/* write header */
-	if(puts("OUmanifest 1\n") == EOF) failed("write manifest header");
+	w_header(ob);
+	w_hash_r(opts, ob);
+
+	hr.ok = true;
+	hr.piece = NULL;
+	hr.pieces = 0;
 
-	/* process manifest records */
-	while(mr_read(&mr))
+	for(j = 0; j < ds.count; j++)
 	{
-		/* if removing records, search through specified files */
-		if(opts->remove)
-		{
-			for(i = 0; (fn = fnames[i]) != NULL; i++)
-				if(check_path(fn, mr.path))
-					break;
+		hr.value = ds.ents[j].hash;
+		w_record(ds.ents[j].path, NULL, &ds.ents[j].statbuf, &hr, opts, ob);
+		free(ds.ents[j].path);
+	}
 
-			if(fn == NULL) continue;
-		}
+	ob_close(ob);
+	if(of.index != NULL) ix_write(of.index, of.pos);
+	free(ds.ents);
+	pthread_mutex_destroy(&ds.lock);
+	pthread_mutex_destroy(&of.lock);
+}
+
+/* look up the paths on the command line in the manifest on standard input, through its path index
+ * the records that are found are output as a manifest */
+void lookup(char **fnames, struct opt_struct *opts)
+{
+	int fd, i;
+	bool missing = false;
+	char *man, *fn;
+	size_t len, lo, hi, mid, n;
+	uint64_t hash, off;
+	struct stat st;
+	struct ix_head *head;
+	struct ix_ent *ents;
+	struct man_rec mr;
+	struct out_file of;
+	struct out_buf *ob;
 
-		/* if adding records, remove path from cache */
-		if(opts->add) hc_rem(mr.path);
+	/* map the index */
+	if((fd = open(opts->lookup_fn, O_RDONLY | O_CLOEXEC)) == -1) failed("open path index");
+	if(fstat(fd, &st) == -1) failed("open path index");
 
-		/* if updating modified records */
-		if(opts->modified)
-		{
-			mr.mtime = statbuf.st_mtim;
-			mr.atime = statbuf.st_atim;
-		}
+	errno = 0;
+	if((uintmax_t)st.st_size < sizeof(struct ix_head)) fail("invalid path index file");
+	if((head = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) failed("map path index");
+	close(fd);
 
-		/* write manifest record */
-		mr_write(&mr);
+	errno = 0;
+	if(memcmp(head->magic, IX_MAGIC, sizeof(head->magic))
+		|| (head->count > (st.st_size - sizeof(struct ix_head)) / sizeof(struct ix_ent)))
+		fail("invalid path index file");
+
+	ents = (struct ix_ent *)(head + 1);
+
+	/* map the manifest, it must be the one the index was made of */
+	if((fstat(STDIN_FILENO, &st) == -1) || !S_ISREG(st.st_mode)) fail("the input manifest must be a regular file");
+	if((uint64_t)st.st_size != head->size) fail("the path index does not match the input manifest");
+
+	if(st.st_size == 0) man = NULL;
+	else if((man = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, STDIN_FILENO, 0)) == MAP_FAILED)
+		failed("map input manifest");
+
+	of.fd = STDOUT_FILENO;
+	of.pos = 0;
+	if(pthread_mutex_init(&of.lock, NULL)) failed("initialize output lock");
+	of.hp = NULL;
+	of.links = NULL;
+	of.dups = NULL;
+	of.index = NULL;
+	of.front = false;
+	ob = ob_prep(&of);
+
+	w_header(ob);
+
+	/* the header of the manifest says whether its paths are front-coded */
+	mr_init(&mr, false);
+	if((man == NULL) || ((n = mr_parse(man, man + st.st_size, true, &mr)) == 0) || !is_elem(mr.type, mr.type + mr.type_len, "OUmanifest", 10))
+		bad_input("input is not an Opal manifest file for Unix");
+	mr.front = mr.front_header;
+
+	/* records before the first file, like the hash record, describe the fields of the records that are output */
+	for(off = n; off < (uint64_t)st.st_size; off += n)
+	{
+		if(((n = mr_parse(man + off, man + st.st_size, true, &mr)) == 0) || mr.end || (mr.path != NULL)) break;
+		mr_write(&mr, ob);
 	}
 
-	/* if adding records */
-	if(opts->add)
+	for(i = 0; (fn = fnames[i]) != NULL; i++)
 	{
-		lc = lc_prep(hc);
-		hc_close(hc);
+		len = strlen(fn);
+		hash = xh_hash(fn, len);
 
-		while((fn = lc_next(lc)) != NULL)
+		/* first entry with the path hash */
+		for(lo = 0, hi = head->count; lo < hi; )
 		{
-			if(get_stat(opts->all_lnk, fn, &statbuf, opts->verbose)) continue;
+			mid = lo + (hi - lo) / 2;
+			if(ents[mid].hash < hash) lo = mid + 1;
+			else hi = mid;
+		}
+
+		/* paths can share a hash */
+		for(; (lo < head->count) && (ents[lo].hash == hash); lo++)
+		{
+			if((ents[lo].off >= (uint64_t)st.st_size) || (ents[lo].start > ents[lo].off))
+				fail("invalid path index file");
+
+			/* a front-coded path is read from the last whole one before it */
+			for(off = ents[lo].start; off <= ents[lo].off; off += n)
+				if((n = mr_parse(man + off, man + st.st_size, true, &mr)) == 0) fail("invalid path index file");
 
-			w_file_r(fn, &statbuf, opts);
+			if((off != ents[lo].off + n) || (mr.path == NULL)) fail("invalid path index file");
+			if((mr.path_len == len) && !memcmp(mr.path, fn, len)) break;
 		}
 
-		lc_close(lc);
+		if((lo < head->count) && (ents[lo].hash == hash)) mr_write(&mr, ob);
+		else
+		{
+			fprintf(stderr, "%s: not in the manifest\n", fn);
+			missing = true;
+		}
 	}
+
+	ob_close(ob);
+	mr_free(&mr);
+	pthread_mutex_destroy(&of.lock);
+
+	if(missing) exit(EXIT_FAILURE);
 }
 
 /* create a new manifest */
@@ -644,19 +6911,39 @@ void make_manifest(char **fnames, struct opt_struct *opts)
 	int i;
 	char *fn;
 	struct stat statbuf;
+	struct out_file of;
+	struct out_buf *ob;
+
+	of.fd = STDOUT_FILENO;
+	of.pos = 0;
+	if(pthread_mutex_init(&of.lock, NULL)) failed("initialize output lock");
+	of.hp = hashing(opts) ? hp_prep(opts) : NULL;
+	of.links = (opts->links || hashing(opts)) ? lm_prep() : NULL;
+	of.dups = NULL;
+	of.index = (opts->index_fn != NULL) ? ix_prep(opts->index_fn) : NULL;
+	of.front = opts->front;
+	ob = ob_prep(&of);
 
 	/* write header */
-	if(puts("OUmanifest 1\n") == EOF) failed("write manifest header");
+	w_header(ob);
+	if(hashing(opts)) w_hash_r(opts, ob);
+
+	/* in canonical order, the files on the command line are sorted too */
+	if(opts->canonical)
+	{
+		for(i = 0; fnames[i] != NULL; i++);
+		qsort(fnames, i, sizeof(char *), name_cmp);
+	}
 
 	/* process filenames on the command line */
 	for(i = 0; (fn = fnames[i]) != NULL; i++)
 	{
 		/* get file status */
-		if(get_stat(opts->cmd_lnk, fn, &statbuf, true)) continue;
+		if(get_stat(opts->cmd_lnk, AT_FDCWD, fn, &statbuf, stat_fields(opts), true)) continue;
 
 		/* process a directory or record a file */
-		if(S_ISDIR(statbuf.st_mode)) proc_dir(fn, &statbuf, opts);
-		else w_file_r(fn, &statbuf, opts);
+		if(S_ISDIR(statbuf.st_mode)) proc_dir(fn, &statbuf, opts, ob);
+		else w_file_r(NULL, fn, &statbuf, opts, ob);
 	}
 
 	/* if no files are listed on the command line */
@@ -666,8 +6953,14 @@ void make_manifest(char **fnames, struct opt_struct *opts)
 		if(stat(".", &statbuf) == -1)
 		{perror(fn); exit(EXIT_FAILURE);}
 
-		proc_dir(NULL, &statbuf, opts);
+		proc_dir(NULL, &statbuf, opts, ob);
 	}
+
+	ob_close(ob);
+	if(of.index != NULL) ix_write(of.index, of.pos);
+	if(of.hp != NULL) hp_free(of.hp);
+	if(of.links != NULL) lm_free(of.links);
+	pthread_mutex_destroy(&of.lock);
 }
 
 /* parse file type options */
@@ -703,6 +6996,101 @@ void update_opts(struct opt_struct *opts, char *arg)
 		}
 }
 
+/* parse record order options */
+void order_opts(struct opt_struct *opts, char *arg)
+{
+	int i, c;
+
+	for(i = 0; (c = arg[i]) != '\0'; i++)
+		switch(c)
+		{
+			case 'b': opts->canonical = opts->depth_first = false; break;
+			case 'c': opts->canonical = true; opts->depth_first = false; break;
+			case 'd': opts->depth_first = true; opts->canonical = false; break;
+			default: fprintf(stderr, "\"%c\" is not a record order\n", c); exit(EXIT_FAILURE);
+		}
+}
+
+/* parse thread count */
+unsigned int thread_opts(char *arg)
+{
+	char *end;
+	unsigned long n;
+
+	errno = 0;
+	n = strtoul(arg, &end, 10);
+
+	if(errno || (end == arg) || (*end != '\0') || (n == 0) || (n > 4096))
+	{
+		fprintf(stderr, "\"%s\" is not a valid thread count\n", arg);
+		exit(EXIT_FAILURE);
+	}
+
+	return n;
+}
+
+/* parse the number of directories held open */
+unsigned int open_opts(char *arg)
+{
+	char *end;
+	unsigned long n;
+
+	errno = 0;
+	n = strtoul(arg, &end, 10);
+
+	if(errno || (end == arg) || (*end != '\0') || (n == 0) || (n > 65536))
+	{
+		fprintf(stderr, "\"%s\" is not a valid open directory count\n", arg);
+		exit(EXIT_FAILURE);
+	}
+
+	return n;
+}
+
+/* parse seconds between progress reports */
+unsigned int interval_opts(char *arg)
+{
+	char *end;
+	unsigned long n;
+
+	errno = 0;
+	n = strtoul(arg, &end, 10);
+
+	if(errno || (end == arg) || (*end != '\0') || (n == 0) || (n > 86400))
+	{
+		fprintf(stderr, "\"%s\" is not a valid progress interval\n", arg);
+		exit(EXIT_FAILURE);
+	}
+
+	return n;
+}
+
+/* parse piece size, with an optional K, M, or G suffix */
+uintmax_t piece_opts(char *arg)
+{
+	char *end;
+	unsigned long long n;
+	int shift = 0;
+
+	errno = 0;
+	n = strtoull(arg, &end, 10);
+
+	switch(*end)
+	{
+		case 'K': shift = 10; end++; break;
+		case 'M': shift = 20; end++; break;
+		case 'G': shift = 30; end++; break;
+	}
+
+	if(errno || (end == arg) || (*end != '\0') || (n == 0) || (n > (UINTMAX_MAX >> 1 >> shift)))
+	{
+		fprintf(stderr, "\"%s\" is not a valid piece size\n", arg);
+		exit(EXIT_FAILURE);
+	}
+
+	return (uintmax_t)n << shift;
+}
+
 /* parse metadata options */
 void metadata_opts(struct opt_struct *opts, char *arg)
 {
@@ -713,6 +7101,8 @@ void metadata_opts(struct opt_struct *opts, char *arg)
 		{
 			case 's': opts->size = true; break;
 			case 'm': opts->mtime = true; break;
+			case 'h': opts->hash = true; break;
+			case 'l': opts->links = true; break;
 			default: fprintf(stderr, "\"%c\" does not correspond to a metadata type\n", c); exit(EXIT_FAILURE);
 		}
 }
@@ -723,13 +7113,13 @@ int main(int argc, char **argv)
 	extern char *optarg;
 	extern int opterr, optind, optopt;
 	struct opt_struct opts = {false, false, false, false, false, false,
-		false, false, false, false, false, false, false, false, false};
+		false, false, false, false, false, false, false, false, false, false, false, 1, false, false, false, false, OPEN_DIRS, 0, NULL, false, false, NULL, NULL, false, false, NULL, 0, NULL};
 
 	/* the errno symbol is defined in errno.h */
 	errno = 0;
 
 	/* parse command line */
-	while((c = getopt(argc, argv, "hvt:u:m:HL")) != -1)
+	while((c = getopt(argc, argv, "hvt:u:m:o:O:HLj:DIp:C:dx:l:fsSJ:P:F:")) != -1)
 		switch(c)
 		{
 			case 'h': help(); exit(EXIT_SUCCESS);
@@ -737,13 +7127,55 @@ int main(int argc, char **argv)
 			case 't': file_type_opts(&opts, optarg); break;
 			case 'u': opts.update = true; update_opts(&opts, optarg); break;
 			case 'm': metadata_opts(&opts, optarg); break;
+			case 'o': order_opts(&opts, optarg); break;
+			case 'O': opts.open_dirs = open_opts(optarg); break;
 			case 'H': opts.cmd_lnk = true; opts.all_lnk = false; break;
 			case 'L': opts.all_lnk = opts.cmd_lnk = true; break;
+			case 'j': opts.threads = thread_opts(optarg); break;
+			case 'D': opts.no_sync = true; break;
+			case 'I': opts.uring = true; break;
+			case 'p': opts.piece = piece_opts(optarg); break;
+			case 'C': opts.cache_fn = optarg; break;
+			case 'd': opts.dups = true; break;
+			case 'x': opts.index_fn = optarg; break;
+			case 'l': opts.lookup_fn = optarg; break;
+			case 'f': opts.front = true; break;
+			case 's': opts.sort = true; break;
+			case 'S': opts.stats = true; break;
+			case 'J': opts.stats = true; opts.stats_fn = optarg; break;
+			case 'P': opts.progress = interval_opts(optarg); break;
+			case 'F': opts.progress_fn = optarg; break;
 			case '?': exit(EXIT_FAILURE);
 		}
 
-	if(opts.update) update_manifest(argv + optind, &opts);
+	/* only one of the modes can be chosen */
+	if((opts.lookup_fn != NULL) + opts.dups + opts.sort + opts.update > 1)
+	{
+		fputs("the u, d, l, and s options can't be combined\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+
+	/* sort mode only reads standard input */
+	if(opts.sort && (optind < argc))
+	{
+		fputs("no files can be specified with the s option\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+
+	/* a status file without an interval gets the default one */
+	if((opts.progress_fn != NULL) && (opts.progress == 0)) opts.progress = PG_INTERVAL;
+
+	if(opts.stats) st_prep();
+	if(opts.progress) pg_start(&opts);
+
+	if(opts.lookup_fn != NULL) lookup(argv + optind, &opts);
+	else if(opts.dups) find_dups(argv + optind, &opts);
+	else if(opts.sort) sort_manifest(&opts);
+	else if(opts.update) update_manifest(argv + optind, &opts);
 	else make_manifest(argv + optind, &opts);
 
+	if(progress != NULL) pg_stop();
+	if(stats != NULL) st_report(&opts);
+
 	return EXIT_SUCCESS;
 }
@@ -0,0 +1,708 @@
+/* Opal Manifest benchmark
+ * for Linux
+ * version 1
+ */
+
+
+/* pieces section */
+
+/* wait4() is a GNU extension on some systems */
+#define _GNU_SOURCE
+
+#include <errno.h>
+/* errno
+ * ECHILD
+ * EEXIST
+ */
+
+#include <stdio.h>
+/* fputs()
+ * fprintf()
+ * printf()
+ * snprintf()
+ * putc()
+ * stderr
+ * FILE
+ * fopen()
+ * fscanf()
+ * fclose()
+ */
+
+#include <stdlib.h>
+/* exit()
+ * strtoul()
+ * strtoull()
+ * EXIT_SUCCESS
+ * EXIT_FAILURE
+ */
+
+#include <stdint.h>
+/* uintmax_t
+ * uint64_t
+ */
+
+#include <stdbool.h>
+/* bool
+ * true
+ * false
+ */
+
+#include <string.h>
+/* strlen()
+ * strerror_l()
+ * strcmp()
+ * memcpy()
+ */
+
+#include <locale.h>
+/* uselocale() */
+
+#include <time.h>
+/* struct timespec
+ * clock_gettime()
+ * CLOCK_MONOTONIC
+ */
+
+#include <signal.h>
+/* SIGSTOP
+ * SIGTRAP
+ * raise()
+ * siginfo_t
+ */
+
+#include <unistd.h>
+/* getopt()
+ * fork()
+ * execv()
+ * dup2()
+ * close()
+ * write()
+ * pwrite()
+ * ftruncate()
+ * link()
+ * symlink()
+ * _exit()
+ * STDIN_FILENO
+ * STDOUT_FILENO
+ */
+
+#include <fcntl.h>
+/* open()
+ * O_RDONLY
+ * O_WRONLY
+ * O_CREAT
+ * O_TRUNC
+ */
+
+#include <sys/types.h>
+/* pid_t
+ * ssize_t
+ */
+
+#include <sys/stat.h>
+/* mkdir()
+ * stat()
+ */
+
+#include <sys/wait.h>
+/* waitid()
+ * waitpid()
+ * P_PID
+ * WEXITED
+ * WNOWAIT
+ * WIFEXITED
+ * WEXITSTATUS
+ * WIFSTOPPED
+ * WSTOPSIG
+ * __WALL
+ */
+
+#include <sys/resource.h>
+/* struct rusage
+ * wait4()
+ */
+
+#include <sys/ptrace.h>
+/* ptrace()
+ * PTRACE_TRACEME
+ * PTRACE_SETOPTIONS
+ * PTRACE_SYSCALL
+ * PTRACE_O_TRACESYSGOOD
+ * PTRACE_O_TRACECLONE
+ * PTRACE_O_EXITKILL
+ */
+
+
+/* definitions section */
+
+/* path buffer size */
+#define PATH_SIZE 4096
+
+/* file data is written in blocks of this size */
+#define DATA_BUF (1 << 16)
+
+/* a sparse file has one block of data in the middle */
+#define SPARSE_DATA 4096
+
+/* options */
+struct opt_struct {
+	/* subdirectories per directory, levels below the root, files per directory */
+	unsigned int width, depth, files;
+
+	/* largest file size, sizes are spread evenly over their powers of two */
+	uintmax_t max_size;
+
+	/* every link_every-th file is a hard link to the one before, 0 for none */
+	unsigned int link_every;
+
+	/* a symlink back up to the root in each deepest directory */
+	bool loops;
+
+	/* size of the sparse file in each directory, 0 for none */
+	uintmax_t sparse;
+
+	/* traversal threads of the program, 0 leaves it out */
+	unsigned int threads;
+
+	/* count system calls with a traced run of each phase */
+	bool count;
+
+	uint64_t seed;
+};
+
+/* tree generation context */
+struct gen_con {
+	struct opt_struct *opts;
+	uint64_t state;
+
+	/* path of the directory or file being made */
+	char path[PATH_SIZE];
+
+	/* path of the last regular file, the target of hard links */
+	char last[PATH_SIZE];
+	bool have_last;
+
+	/* what was made, bytes count the data of each file once */
+	uintmax_t dirs, files, links, symlinks, bytes;
+
+	unsigned char buf[DATA_BUF];
+};
+
+/* measurements of a run */
+struct run_stats {
+	double seconds;
+
+	/* peak resident set size, in kilobytes */
+	long rss;
+
+	/* read and write calls counted by the kernel, -1 if unknown */
+	long long syscr, syscw;
+
+	/* all system calls of the traced run, -1 without one */
+	long long syscalls;
+};
+
+
+/* functions section */
+
+/* print error message and quit */
+void fail(char *message)
+{
+	/* print error message */
+	fputs(message, stderr);
+	/* elaborate on the error if possible */
+	if(errno) fprintf(stderr, ": %s", strerror_l(errno, uselocale(0)));
+	putc('\n', stderr);
+	exit(EXIT_FAILURE);
+}
+
+/* "failed to" <error message> and quit */
+void failed(char *message)
+{
+	/* prepend "failed to" to the error message */
+	fputs("failed to ", stderr);
+	fail(message);
+}
+
+/* help message */
+void help()
+{
+	char message[] = "Opal Manifest benchmark\n"
+	"version 1\n\n"
+
+	"This program makes a synthetic file hierarchy in a directory and times the manifest program on it. The program and the directory are specified on the command line, and the directory must not exist yet. Each phase is reported on one line of standard output as space-separated key=value pairs.\n\n"
+
+	"options\n"
+	"h: output help and exit\n"
+	"w: subdirectories in each directory (default 4)\n"
+	"e: levels of subdirectories below the root (default 3)\n"
+	"n: regular files in each directory (default 32)\n"
+	"s: largest file size, with a K, M, or G suffix (default 64K)\n"
+	"k: make every Nth file a hard link to the file before it\n"
+	"y: put a symlink back up to the root in each of the deepest directories, a loop for traversals that follow symlinks\n"
+	"z: put a sparse file of this size in each directory, with a K, M, G, or T suffix\n"
+	"j: number of threads passed to the manifest program\n"
+	"c: count system calls with an extra traced run of each phase\n"
+	"r: seed of the file sizes and data (default 1)\n\n"
+
+	"phases\n"
+	"generate: making the hierarchy\n"
+	"make: a manifest of sizes and modification times, breadth-first\n"
+	"canonical: the same manifest in canonical order\n"
+	"update: updating the canonical manifest, which has not changed\n"
+	"parse: sorting the canonical manifest with the s option, which reads every record without touching the hierarchy, its bytes are those of the manifest\n"
+	"hash: a manifest of the regular files with hashes\n\n"
+
+	"The reads and writes are read and write calls counted in /proc/PID/io. Directory reads and status calls are only in the syscalls count of the c option. Per file figures count every directory entry that was made.\n";
+
+	fputs(message, stderr);
+}
+
+/* next pseudorandom number (xorshift64*) */
+uint64_t rnd(struct gen_con *gc)
+{
+	gc->state ^= gc->state >> 12;
+	gc->state ^= gc->state << 25;
+	gc->state ^= gc->state >> 27;
+	return gc->state * 0x2545F4914F6CDD1DULL;
+}
+
+/* pick a file size, small files are as likely as large ones */
+uintmax_t gen_size(struct gen_con *gc)
+{
+	unsigned int bits;
+	uintmax_t max;
+
+	max = gc->opts->max_size;
+	for(bits = 0; (bits < 63) && ((uintmax_t)1 << bits) <= max; bits++);
+
+	bits = rnd(gc) % (bits + 1);
+	if(bits == 0) return 0;
+
+	return (rnd(gc) % (((uintmax_t)1 << bits) - 1) + 1) % (max + 1);
+}
+
+/* make a regular file of the given size */
+void gen_file(struct gen_con *gc, uintmax_t size)
+{
+	int fd;
+	size_t i, len;
+
+	if((fd = open(gc->path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1) failed(gc->path);
+
+	while(size)
+	{
+		len = (size < DATA_BUF) ? size : DATA_BUF;
+		for(i = 0; i + 8 <= len; i += 8)
+		{
+			uint64_t r = rnd(gc);
+			memcpy(gc->buf + i, &r, 8);
+		}
+		for(; i < len; i++) gc->buf[i] = rnd(gc);
+
+		if(write(fd, gc->buf, len) != (ssize_t)len) failed("write file data");
+		size -= len;
+	}
+
+	close(fd);
+}
+
+/* make a sparse file with one block of data in the middle */
+void gen_sparse(struct gen_con *gc)
+{
+	int fd;
+	size_t i;
+	uintmax_t size;
+
+	size = gc->opts->sparse;
+	if((fd = open(gc->path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1) failed(gc->path);
+	if(ftruncate(fd, size) == -1) failed("set sparse file size");
+
+	for(i = 0; i < SPARSE_DATA; i++) gc->buf[i] = rnd(gc);
+	if(size >= SPARSE_DATA)
+		if(pwrite(fd, gc->buf, SPARSE_DATA, (size / 2) & ~(uintmax_t)(SPARSE_DATA - 1)) != SPARSE_DATA)
+			failed("write sparse file data");
+
+	close(fd);
+}
+
+/* set the name of the current path after the directory path of the given length */
+void gen_name(struct gen_con *gc, size_t len, char *prefix, unsigned int n)
+{
+	if(snprintf(gc->path + len, PATH_SIZE - len, "/%s%u", prefix, n) >= (int)(PATH_SIZE - len))
+		fail("path too long");
+}
+
+/* fill the directory at the current path */
+void gen_dir(struct gen_con *gc, unsigned int level)
+{
+	unsigned int i;
+	size_t len;
+	uintmax_t size;
+	struct opt_struct *opts;
+
+	opts = gc->opts;
+	len = strlen(gc->path);
+
+	if(mkdir(gc->path, 0755) == -1) failed(gc->path);
+	gc->dirs++;
+
+	for(i = 0; i < opts->files; i++)
+	{
+		gen_name(gc, len, "f", i);
+
+		/* another link to the last file */
+		if(opts->link_every && gc->have_last && ((gc->files + gc->links + 1) % opts->link_every == 0))
+		{
+			if(link(gc->last, gc->path) == -1) failed("make hard link");
+			gc->links++;
+			continue;
+		}
+
+		size = gen_size(gc);
+		gen_file(gc, size);
+		memcpy(gc->last, gc->path, strlen(gc->path) + 1);
+		gc->have_last = true;
+		gc->files++;
+		gc->bytes += size;
+	}
+
+	if(opts->sparse)
+	{
+		gen_name(gc, len, "s", 0);
+		gen_sparse(gc);
+		gc->files++;
+		gc->bytes += opts->sparse;
+	}
+
+	/* a symlink to the root makes a loop for traversals that follow it */
+	if((level == opts->depth) && opts->loops)
+	{
+		char target[PATH_SIZE];
+		unsigned int j;
+		size_t t = 0;
+
+		for(j = 0; j < level; j++)
+		{
+			memcpy(target + t, j ? "/.." : "..", j ? 3 : 2);
+			t += j ? 3 : 2;
+		}
+		memcpy(target + t, level ? "" : ".", level ? 1 : 2);
+
+		gen_name(gc, len, "loop", 0);
+		if(symlink(target, gc->path) == -1) failed("make symlink");
+		gc->symlinks++;
+	}
+
+	if(level < opts->depth)
+		for(i = 0; i < opts->width; i++)
+		{
+			gen_name(gc, len, "d", i);
+			gen_dir(gc, level + 1);
+		}
+
+	gc->path[len] = '\0';
+}
+
+/* seconds since an arbitrary point */
+double now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* start the program with its standard input and output redirected, traced if asked */
+pid_t start(char **args, char *in_fn, char *out_fn, bool traced)
+{
+	int fd;
+	pid_t pid;
+
+	if((pid = fork()) == -1) failed("start program");
+	if(pid) return pid;
+
+	if(in_fn != NULL)
+	{
+		if((fd = open(in_fn, O_RDONLY)) == -1) _exit(126);
+		dup2(fd, STDIN_FILENO);
+		close(fd);
+	}
+
+	if((fd = open(out_fn, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1) _exit(126);
+	dup2(fd, STDOUT_FILENO);
+	close(fd);
+
+	/* stop for the tracer to set its options */
+	if(traced)
+	{
+		if(ptrace(PTRACE_TRACEME, 0, NULL, NULL) == -1) _exit(126);
+		raise(SIGSTOP);
+	}
+
+	execv(args[0], args);
+	_exit(127);
+}
+
+/* check how the program ended */
+void check_exit(int status)
+{
+	if((!WIFEXITED(status)) || WEXITSTATUS(status))
+	{
+		errno = 0;
+		fail("the manifest program failed");
+	}
+}
+
+/* count the system calls of a traced program, all of its threads included */
+long long count_calls(pid_t pid)
+{
+	int status, sig;
+	long long stops = 0;
+	pid_t t;
+
+	/* the first stop is the one before exec */
+	if(waitpid(pid, &status, 0) == -1) failed("wait for program");
+	if(ptrace(PTRACE_SETOPTIONS, pid, NULL, (void *)(long)(PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE | PTRACE_O_EXITKILL)) == -1)
+		failed("trace program");
+	if(ptrace(PTRACE_SYSCALL, pid, NULL, NULL) == -1) failed("trace program");
+
+	while((t = waitpid(-1, &status, __WALL)) != -1)
+	{
+		if(!WIFSTOPPED(status))
+		{
+			if(t == pid) check_exit(status);
+			continue;
+		}
+
+		sig = WSTOPSIG(status);
+
+		/* each call stops on entry and exit */
+		if(sig == (SIGTRAP | 0x80))
+		{
+			stops++;
+			sig = 0;
+		}
+
+		/* new threads start stopped, and clone events are not signals */
+		else if((sig == SIGSTOP) || (sig == SIGTRAP)) sig = 0;
+
+		ptrace(PTRACE_SYSCALL, t, NULL, (void *)(long)sig);
+	}
+
+	if(errno != ECHILD) failed("wait for program");
+
+	return stops / 2;
+}
+
+/* run the program once and measure it */
+void run(char **args, char *in_fn, char *out_fn, struct opt_struct *opts, struct run_stats *rs)
+{
+	int status;
+	pid_t pid;
+	double start_time;
+	char fn[64];
+	FILE *fp;
+	long long v;
+	char key[32];
+	siginfo_t info;
+	struct rusage ru;
+
+	start_time = now();
+	pid = start(args, in_fn, out_fn, false);
+
+	/* leave the program waiting to be reaped so its counters can be read */
+	if(waitid(P_PID, pid, &info, WEXITED | WNOWAIT) == -1) failed("wait for program");
+	rs->seconds = now() - start_time;
+
+	rs->syscr = rs->syscw = -1;
+	snprintf(fn, sizeof(fn), "/proc/%ld/io", (long)pid);
+	if((fp = fopen(fn, "r")) != NULL)
+	{
+		while(fscanf(fp, "%31[^:]: %lld\n", key, &v) == 2)
+		{
+			if(!strcmp(key, "syscr")) rs->syscr = v;
+			else if(!strcmp(key, "syscw")) rs->syscw = v;
+		}
+		fclose(fp);
+	}
+
+	if(wait4(pid, &status, 0, &ru) == -1) failed("wait for program");
+	check_exit(status);
+	rs->rss = ru.ru_maxrss;
+
+	rs->syscalls = -1;
+	if(opts->count) rs->syscalls = count_calls(start(args, in_fn, out_fn, true));
+}
+
+/* output a figure per entry, or -1 if it is unknown */
+void per_entry(char *name, long long n, uintmax_t entries)
+{
+	if(n < 0) printf(" %s=-1", name);
+	else printf(" %s=%.2f", name, entries ? (double)n / entries : 0.0);
+}
+
+/* output the measurements of a phase */
+void report(char *phase, struct run_stats *rs, uintmax_t entries, uintmax_t bytes)
+{
+	printf("phase=%s seconds=%.6f files_per_s=%.0f bytes_per_s=%.0f", phase, rs->seconds,
+		rs->seconds > 0 ? entries / rs->seconds : 0.0, rs->seconds > 0 ? bytes / rs->seconds : 0.0);
+	per_entry("reads_per_file", rs->syscr, entries);
+	per_entry("writes_per_file", rs->syscw, entries);
+	per_entry("syscalls_per_file", rs->syscalls, entries);
+	printf(" peak_rss_kb=%ld\n", rs->rss);
+}
+
+/* parse a count */
+unsigned int count_opts(char *arg, char *what, unsigned long max)
+{
+	char *end;
+	unsigned long n;
+
+	errno = 0;
+	n = strtoul(arg, &end, 10);
+
+	if(errno || (end == arg) || (*end != '\0') || (n > max))
+	{
+		fprintf(stderr, "\"%s\" is not a valid %s\n", arg, what);
+		exit(EXIT_FAILURE);
+	}
+
+	return n;
+}
+
+/* parse a size, with an optional K, M, G, or T suffix */
+uintmax_t size_opts(char *arg)
+{
+	char *end;
+	unsigned long long n;
+	int shift = 0;
+
+	errno = 0;
+	n = strtoull(arg, &end, 10);
+
+	switch(*end)
+	{
+		case 'K': shift = 10; end++; break;
+		case 'M': shift = 20; end++; break;
+		case 'G': shift = 30; end++; break;
+		case 'T': shift = 40; end++; break;
+	}
+
+	if(errno || (end == arg) || (*end != '\0') || (n > (UINTMAX_MAX >> 1 >> shift)))
+	{
+		fprintf(stderr, "\"%s\" is not a valid size\n", arg);
+		exit(EXIT_FAILURE);
+	}
+
+	return (uintmax_t)n << shift;
+}
+
+int main(int argc, char **argv)
+{
+	int c;
+	size_t n;
+	extern char *optarg;
+	extern int optind;
+	char *prog, *dir, *args[16], threads[16];
+	char tree_fn[PATH_SIZE], make_fn[PATH_SIZE], canon_fn[PATH_SIZE], hash_fn[PATH_SIZE], update_fn[PATH_SIZE];
+	double start_time;
+	uintmax_t entries;
+	struct stat st;
+	static struct gen_con gc;
+	struct run_stats gen_rs, make_rs, canon_rs, hash_rs, update_rs, parse_rs;
+	struct opt_struct opts = {4, 3, 32, 64 << 10, 0, false, 0, 0, false, 1};
+
+	/* the errno symbol is defined in errno.h */
+	errno = 0;
+
+	/* parse command line */
+	while((c = getopt(argc, argv, "hw:e:n:s:k:yz:j:cr:")) != -1)
+		switch(c)
+		{
+			case 'h': help(); exit(EXIT_SUCCESS);
+			case 'w': opts.width = count_opts(optarg, "width", 1 << 20); break;
+			case 'e': opts.depth = count_opts(optarg, "depth", 256); break;
+			case 'n': opts.files = count_opts(optarg, "file count", 1 << 24); break;
+			case 's': opts.max_size = size_opts(optarg); break;
+			case 'k': opts.link_every = count_opts(optarg, "link interval", 1 << 24); break;
+			case 'y': opts.loops = true; break;
+			case 'z': opts.sparse = size_opts(optarg); break;
+			case 'j': opts.threads = count_opts(optarg, "thread count", 4096); break;
+			case 'c': opts.count = true; break;
+			case 'r': opts.seed = count_opts(optarg, "seed", 0xFFFFFFFFUL); break;
+			case '?': exit(EXIT_FAILURE);
+		}
+
+	if(argc - optind != 2)
+	{
+		help();
+		exit(EXIT_FAILURE);
+	}
+
+	prog = argv[optind];
+	dir = argv[optind + 1];
+
+	if(strlen(dir) > PATH_SIZE - 64) fail("directory path too long");
+	snprintf(tree_fn, PATH_SIZE, "%s/tree", dir);
+	snprintf(make_fn, PATH_SIZE, "%s/make.oumnf", dir);
+	snprintf(canon_fn, PATH_SIZE, "%s/canonical.oumnf", dir);
+	snprintf(hash_fn, PATH_SIZE, "%s/hash.oumnf", dir);
+	snprintf(update_fn, PATH_SIZE, "%s/update.oumnf", dir);
+
+	if(mkdir(dir, 0755) == -1) failed(dir);
+
+	/* make the hierarchy */
+	gc.opts = &opts;
+	gc.state = opts.seed * 0x9E3779B97F4A7C15ULL + 1;
+	memcpy(gc.path, tree_fn, strlen(tree_fn) + 1);
+	start_time = now();
+	gen_dir(&gc, 0);
+	gen_rs.seconds = now() - start_time;
+	gen_rs.rss = 0;
+	gen_rs.syscr = gen_rs.syscw = gen_rs.syscalls = -1;
+
+	entries = gc.dirs + gc.files + gc.links + gc.symlinks;
+	printf("tree dirs=%ju files=%ju links=%ju symlinks=%ju entries=%ju bytes=%ju\n",
+		gc.dirs, gc.files, gc.links, gc.symlinks, entries, gc.bytes);
+	report("generate", &gen_rs, entries, gc.bytes);
+
+	/* the common arguments */
+	n = 0;
+	args[n++] = prog;
+	if(opts.threads)
+	{
+		snprintf(threads, sizeof(threads), "%u", opts.threads);
+		args[n++] = "-j";
+		args[n++] = threads;
+	}
+
+	/* metadata of every file type, breadth-first */
+	args[n] = "-t"; args[n + 1] = "rdlcbf"; args[n + 2] = "-m"; args[n + 3] = "sm";
+	args[n + 4] = tree_fn; args[n + 5] = NULL;
+	run(args, NULL, make_fn, &opts, &make_rs);
+	report("make", &make_rs, entries, 0);
+
+	/* the same in canonical order */
+	args[n + 4] = "-o"; args[n + 5] = "c"; args[n + 6] = tree_fn; args[n + 7] = NULL;
+	run(args, NULL, canon_fn, &opts, &canon_rs);
+	report("canonical", &canon_rs, entries, 0);
+
+	/* update of the canonical manifest */
+	args[n + 4] = "-u"; args[n + 5] = "arm";
+	run(args, canon_fn, update_fn, &opts, &update_rs);
+	report("update", &update_rs, entries, 0);
+
+	/* reading the canonical manifest alone, sorting it leaves it as it is */
+	if(stat(canon_fn, &st) == -1) failed(canon_fn);
+	args[n] = "-s"; args[n + 1] = NULL;
+	run(args, canon_fn, "/dev/null", &opts, &parse_rs);
+	report("parse", &parse_rs, entries, st.st_size);
+
+	/* hashes of the regular files */
+	args[n] = "-t"; args[n + 1] = "r"; args[n + 2] = "-m"; args[n + 3] = "smh"; args[n + 4] = tree_fn; args[n + 5] = NULL;
+	run(args, NULL, hash_fn, &opts, &hash_rs);
+	report("hash", &hash_rs, gc.files + gc.links, gc.bytes);
+
+	return EXIT_SUCCESS;
+}